@@ -28,6 +28,67 @@ class CTCBeamDecoder(object):
         lm_type (str): Whether the language model file is character, bpe or word based
         token_separator (str): prefix of the bpe tokens. Default value is "#" and it is always assumed that the tokens
             starting with this prefix are meant to be merged with tokens that doesn't contain this prefix
+        shared_scorer_path (str): Path used to share the scorer between processes. The first process publishes the
+            lexicon there and the later ones memory map it read-only instead of rebuilding it. It must be unique to the
+            language model, labels and lexicon. Default value is None i.e. the scorer is not shared.
+        lm_load_method (str): How the language model is loaded in memory. "lazy" maps the binary model and faults its
+            pages on first access, "populate" maps and pre-faults it, "huge_pages" reads the model in memory backed by
+            transparent huge pages (not shared between processes). Default value is "populate".
+        num_prune_threads (int): Number of threads pruning the upcoming frames of a long sequence in parallel with
+            the beam search of each item. Default value is 0 i.e. the frames are pruned by the beam search.
+        min_cutoff_top_n (int): Enables the adaptive pruning when not 0: the number of candidates of each frame follows
+            its entropy, between min_cutoff_top_n and cutoff_top_n. Confident frames expand fewer tokens while ambiguous
+            frames keep up to cutoff_top_n. Default value is 0 i.e. every frame keeps cutoff_top_n candidates.
+        adaptive_cutoff_scale (float): Number of candidates of a frame per unit of its perplexity (the exponential of its
+            entropy) in the adaptive pruning. Default value is 2.0.
+        greedy_margin (float): Enables the hybrid greedy/beam decoding when not 0: the frames whose top token leads the
+            second one by greedy_margin or more in probability only expand their top token, and from a confident word
+            boundary the beam keeps its best prefix alone until the next uncertain frame. The full beam search then only
+            runs on the uncertain spans. Default value is 0 i.e. every frame runs the full beam search.
+        lm_lookahead (bool): With a word based language model and its lexicon, rank the partial words with the best
+            unigram score of the words they can still complete, rather than on their acoustic score alone, which lets a
+            smaller beam_width reach the same accuracy. Default value is False.
+        max_trie_nodes (int): Budget of nodes of the prefix trie of each item. Over budget, the beam is halved for the
+            next frames until the trie fits, and widens back once the trie is under half the budget. Bounds the memory
+            of inputs such as noise with near uniform probabilities. The budget counts nodes, not bytes: the partial
+            hotwords of the nodes add to their fixed size. Default value is 0 i.e. no budget.
+        segment_min_pause (int): Enables the long form decoding when not 0: each sequence is cut in the middle of its
+            pauses, the runs of at least segment_min_pause frames whose blank probability is segment_blank_prob or more,
+            and its segments are decoded in parallel on the num_processes workers. A sequence cut into several segments
+            has a single hypothesis, stitched from the best result of each segment, with the timesteps of the whole
+            sequence and the sum of their scores; its other beams are empty, with a length of 0.
+            Default value is 0 i.e. the sequences are decoded whole.
+        segment_blank_prob (float): Blank probability of the frames of a pause in the long form decoding.
+            Default value is 0.999.
+        segment_context_frames (int): Number of frames before its cut decoded with each segment in the long form
+            decoding, which approximate the language model context over the cut. The tokens decoded in them are
+            dropped. Default value is 0 i.e. each segment starts without context.
+        segment_carry_context (bool): Decode the segments of a sequence one after the other in the long form decoding,
+            each starting from the language model context of the best results of the previous ones, which is then the
+            same as in a whole decode. Only the sequences of the batch are decoded in parallel. It can't be combined
+            with segment_context_frames. Default value is False.
+        lockstep_batch (bool): Decode the batch in lockstep: each of the num_processes workers advances its share of the
+            batch one frame at a time over all its utterances, updates the blanks and repeats of all their beams together
+            and scores their language model queries together. Suits large batches of short utterances. The frames are
+            pruned one by one, without num_prune_threads. It can't be combined with segment_min_pause or
+            offline_priority. Default value is False i.e. each utterance is decoded on its own.
+        offline_priority (bool): Decode the batch as low priority work on the workers of the OnlineCTCBeamDecoder
+            instances with as many num_processes and the same worker_pinning, so that their streaming chunks run first.
+            Each utterance yields to the waiting streaming chunks every preemption_frames frames. It can't be combined
+            with segment_min_pause or lockstep_batch. Default value is False i.e. the batch is decoded on workers of its
+            own.
+        preemption_frames (int): Number of frames an offline utterance decodes between two yields to the streaming
+            chunks, which bounds their wait. Default value is 50.
+        worker_pinning (str): Placement of the shared workers with offline_priority, see OnlineCTCBeamDecoder.
+            Default value is "none".
+        deadline_ms (float): Time budget in milliseconds of the decoding of each item, or of each of its segments with
+            segment_min_pause. The decoder narrows beam_width and cutoff_top_n when its pace would miss the deadline,
+            and returns its best results so far once the deadline passes. Such items are flagged in the degraded result
+            of decode(return_degraded=True). Default value is 0 i.e. no deadline.
+        hotwords (List[List[str]]): Tokenized list of hotwords boosted in every decode, see decode(). Their scorer is
+            compiled in parallel with the loading of the language model and the lexicon. Default value is None i.e.
+            no hotwords unless decode() is given some.
+        hotword_weight (Union[float, List[float]]): Weight of the hotwords, see decode(). Default value is 10.0.
     """
 
     def __init__(
@@ -47,10 +108,31 @@ class CTCBeamDecoder(object):
         lm_type: str = "character",
         token_separator: str = "#",
         lexicon_fst_path: Optional[str] = None,
+        shared_scorer_path: Optional[str] = None,
+        lm_load_method: str = "populate",
+        num_prune_threads: int = 0,
+        min_cutoff_top_n: int = 0,
+        adaptive_cutoff_scale: float = 2.0,
+        greedy_margin: float = 0.0,
+        lm_lookahead: bool = False,
+        max_trie_nodes: int = 0,
+        segment_min_pause: int = 0,
+        segment_blank_prob: float = 0.999,
+        segment_context_frames: int = 0,
+        segment_carry_context: bool = False,
+        lockstep_batch: bool = False,
+        offline_priority: bool = False,
+        preemption_frames: int = 50,
+        worker_pinning: str = "none",
+        deadline_ms: float = 0.0,
+        hotwords: Optional[List[List[str]]] = None,
+        hotword_weight: Union[float, List[float]] = 10.0,
     ):
         self.cutoff_top_n = cutoff_top_n
         self._beam_width = beam_width
         self._scorer = None
+        self._hotword_scorer = None
+        self._load_stats = None
         self._num_processes = num_processes
         self._labels = list(labels)  # Ensure labels are a list
         self._num_labels = len(labels)
@@ -59,16 +141,8 @@ class CTCBeamDecoder(object):
         self.token_separator = token_separator
 
         lexicon_fst_path = lexicon_fst_path if lexicon_fst_path is not None else ""
+        shared_scorer_path = shared_scorer_path if shared_scorer_path is not None else ""
 
-        if model_path:
-            self._scorer = ctc_decode.paddle_get_scorer(
-                alpha,
-                beta,
-                model_path.encode(),
-                self._labels,
-                lm_type,
-                lexicon_fst_path.encode(),
-            )
         self._is_bpe_based = is_bpe_based
         self._cutoff_prob = cutoff_prob
 
@@ -84,6 +158,52 @@ class CTCBeamDecoder(object):
             unk_score,
             token_separator,
         )
+        if model_path or hotwords:
+            # the language model, the lexicon and the hotwords are loaded in parallel
+            self._scorer, self._hotword_scorer, self._load_stats = (
+                ctc_decode.paddle_load_decoder_resources(
+                    self.decoder_options,
+                    alpha,
+                    beta,
+                    model_path if model_path else "",
+                    lm_type,
+                    lexicon_fst_path,
+                    shared_scorer_path,
+                    lm_load_method,
+                    hotwords if hotwords else [],
+                    self._hotword_weights(hotwords, hotword_weight) if hotwords else [],
+                )
+            )
+        if num_prune_threads:
+            ctc_decode.set_num_prune_threads(self.decoder_options, num_prune_threads)
+        if min_cutoff_top_n:
+            ctc_decode.set_adaptive_cutoff(
+                self.decoder_options, min_cutoff_top_n, adaptive_cutoff_scale
+            )
+        if greedy_margin:
+            ctc_decode.set_greedy_margin(self.decoder_options, greedy_margin)
+        if lm_lookahead:
+            ctc_decode.set_lm_lookahead(self.decoder_options, lm_lookahead)
+        if max_trie_nodes:
+            ctc_decode.set_max_trie_nodes(self.decoder_options, max_trie_nodes)
+        if segment_min_pause:
+            ctc_decode.set_long_form_segmentation(
+                self.decoder_options,
+                segment_min_pause,
+                segment_blank_prob,
+                segment_context_frames,
+                segment_carry_context,
+            )
+        if lockstep_batch:
+            ctc_decode.set_lockstep_batch(self.decoder_options, lockstep_batch)
+        if offline_priority:
+            ctc_decode.set_offline_priority(
+                self.decoder_options, offline_priority, preemption_frames
+            )
+        if worker_pinning != "none":
+            ctc_decode.set_worker_pinning(self.decoder_options, worker_pinning, False)
+        if deadline_ms:
+            ctc_decode.set_deadline(self.decoder_options, deadline_ms, False)
 
     def create_hotword_scorer(
         self,
@@ -100,20 +220,26 @@ class CTCBeamDecoder(object):
         hotword_weight (Union[float, List[float]]) - Weight for each hotword. The weight for all the hotwords will be same when only one weight is provided.
             ( default = 10.0 )
         """
+        hotword_scorer = ctc_decode.get_hotword_scorer(
+            self.decoder_options,
+            hotwords,
+            self._hotword_weights(hotwords, hotword_weight),
+            self.token_separator,
+        )
+
+        return hotword_scorer
+
+    @staticmethod
+    def _hotword_weights(hotwords, hotword_weight):
         if isinstance(hotword_weight, float) or isinstance(hotword_weight, int):
-            hotword_weight = [hotword_weight] * len(hotwords)
+            return [hotword_weight] * len(hotwords)
         elif (
             isinstance(hotword_weight, List)
             and isinstance(hotwords, List)
             and len(hotwords) != len(hotword_weight)
         ):
             raise ValueError("Hotword weight list and Hotwords length doesn't match.")
-
-        hotword_scorer = ctc_decode.get_hotword_scorer(
-            self.decoder_options, hotwords, hotword_weight, self.token_separator
-        )
-
-        return hotword_scorer
+        return hotword_weight
 
     def decode(
         self,
@@ -122,6 +248,7 @@ class CTCBeamDecoder(object):
         hotword_scorer=None,
         hotwords: List[List[str]] = None,
         hotword_weight: Union[float, List[float]] = 10.0,
+        return_degraded: bool = False,
     ):
         """
         Conducts the beamsearch on model outputs and return results.
@@ -136,9 +263,10 @@ class CTCBeamDecoder(object):
         hotword_weight (Union[float, List[float]]) - This is the boost factor for scoring the hotword when appeared in the beam path. Recommend to
             use the range between 0 - 15 for each hotword. If single value is provided then the same weigh will be used for all
             the hotwords
+        return_degraded (bool) - Also return the degraded flags of the items, see deadline_ms.
 
         Returns:
-        tuple: (beam_results, beam_scores, timesteps, out_lens)
+        tuple: (beam_results, beam_scores, timesteps, out_lens), followed by degraded with return_degraded
 
         beam_results (Tensor): A 3-dim tensor representing the top n beams of a batch of items.
                                 Shape: batchsize x num_beams x num_timesteps.
@@ -151,6 +279,8 @@ class CTCBeamDecoder(object):
                                 Shape: batchsize x num_beams
         out_lens (Tensor): A 2-dim tensor representing the length of each beam in beam_results.
                                 Shape: batchsize x n_beams.
+        degraded (Tensor): A 1-dim bool tensor, True for the items whose decoding was narrowed or cut short to
+                                meet deadline_ms. Shape: batchsize.
 
         """
         probs = probs.cpu().float()
@@ -168,13 +298,14 @@ class CTCBeamDecoder(object):
         # if hotwords list is provided then create a scorer for it
         if hotwords:
             hotword_scorer = self.create_hotword_scorer(hotwords, hotword_weight)
+        elif not hotword_scorer:
+            hotword_scorer = self._hotword_scorer
 
         output = torch.IntTensor(batch_size, self._beam_width, max_seq_len).cpu().int()
-        timesteps = (
-            torch.IntTensor(batch_size, self._beam_width, max_seq_len).cpu().int()
-        )
+        timesteps = torch.IntTensor(batch_size, self._beam_width, max_seq_len).cpu().int()
         scores = torch.FloatTensor(batch_size, self._beam_width).cpu().float()
         out_seq_len = torch.zeros(batch_size, self._beam_width).cpu().int()
+        degraded = torch.zeros(batch_size).cpu().int()
 
         if not self._scorer and not hotword_scorer:
             ctc_decode.paddle_beam_decode(
@@ -185,6 +316,7 @@ class CTCBeamDecoder(object):
                 timesteps,
                 scores,
                 out_seq_len,
+                degraded,
             )
         elif self._scorer and not hotword_scorer:
             ctc_decode.paddle_beam_decode_with_lm(
@@ -196,6 +328,7 @@ class CTCBeamDecoder(object):
                 timesteps,
                 scores,
                 out_seq_len,
+                degraded,
             )
         elif not self._scorer and hotword_scorer:
             ctc_decode.paddle_beam_decode_with_hotwords(
@@ -207,6 +340,7 @@ class CTCBeamDecoder(object):
                 timesteps,
                 scores,
                 out_seq_len,
+                degraded,
             )
         else:
             ctc_decode.paddle_beam_decode_with_lm_and_hotwords(
@@ -219,11 +353,14 @@ class CTCBeamDecoder(object):
                 timesteps,
                 scores,
                 out_seq_len,
+                degraded,
             )
 
         if hotwords:
             self.delete_hotword_scorer(hotword_scorer)
 
+        if return_degraded:
+            return output, scores, timesteps, out_seq_len, degraded.bool()
         return output, scores, timesteps, out_seq_len
 
     def character_based(self):
@@ -235,6 +372,22 @@ class CTCBeamDecoder(object):
     def dict_size(self):
         return ctc_decode.get_dict_size(self._scorer) if self._scorer else None
 
+    def warmup(self, num_time_steps: int = 100):
+        """
+        Pre-faults the language model and lexicon memory and runs a synthetic decode, so that latency is
+        stable from the first real request.
+        Args:
+        num_time_steps (int) - Number of synthetic time steps to decode. ( default = 100 )
+        """
+        ctc_decode.paddle_warmup(self.decoder_options, self._scorer, num_time_steps)
+
+    def load_stats(self):
+        """
+        Returns the time in seconds spent in loading the language model and the lexicon, as a dict
+        with `lm_seconds`, `lexicon_seconds`, `hotword_seconds` and `total_seconds` keys.
+        """
+        return self._load_stats
+
     def reset_params(self, alpha, beta):
         if self._scorer is not None:
             ctc_decode.reset_params(self._scorer, alpha, beta)
@@ -242,6 +395,8 @@ class CTCBeamDecoder(object):
     def __del__(self):
         if self._scorer is not None:
             ctc_decode.paddle_release_scorer(self._scorer)
+        if self._hotword_scorer is not None:
+            ctc_decode.paddle_release_hotword_scorer(self._hotword_scorer)
         if self.decoder_options:
             ctc_decode.paddle_release_decoder_options(self.decoder_options)
 
@@ -274,6 +429,44 @@ class OnlineCTCBeamDecoder(object):
             starting with this prefix are meant to be merged with tokens that doesn't contain this prefix
         lexicon_fst_path (str): Path to the fst model file for decoding. It can be either be optimized or not. If not provided then
             fst will not be used for decoding. Default value is None.
+        shared_scorer_path (str): Path used to share the scorer between processes. The first process publishes the
+            lexicon there and the later ones memory map it read-only instead of rebuilding it. It must be unique to the
+            language model, labels and lexicon. Default value is None i.e. the scorer is not shared.
+        lm_load_method (str): How the language model is loaded in memory. "lazy" maps the binary model and faults its
+            pages on first access, "populate" maps and pre-faults it, "huge_pages" reads the model in memory backed by
+            transparent huge pages (not shared between processes). Default value is "populate".
+        num_prune_threads (int): Number of threads pruning the upcoming frames of a long sequence in parallel with
+            the beam search of each item. Default value is 0 i.e. the frames are pruned by the beam search.
+        min_cutoff_top_n (int): Enables the adaptive pruning when not 0: the number of candidates of each frame follows
+            its entropy, between min_cutoff_top_n and cutoff_top_n. Confident frames expand fewer tokens while ambiguous
+            frames keep up to cutoff_top_n. Default value is 0 i.e. every frame keeps cutoff_top_n candidates.
+        adaptive_cutoff_scale (float): Number of candidates of a frame per unit of its perplexity (the exponential of its
+            entropy) in the adaptive pruning. Default value is 2.0.
+        greedy_margin (float): Enables the hybrid greedy/beam decoding when not 0: the frames whose top token leads the
+            second one by greedy_margin or more in probability only expand their top token, and from a confident word
+            boundary the beam keeps its best prefix alone until the next uncertain frame. The full beam search then only
+            runs on the uncertain spans. Default value is 0 i.e. every frame runs the full beam search.
+        lm_lookahead (bool): With a word based language model and its lexicon, rank the partial words with the best
+            unigram score of the words they can still complete, rather than on their acoustic score alone, which lets a
+            smaller beam_width reach the same accuracy. Default value is False.
+        max_trie_nodes (int): Budget of nodes of the prefix trie of each item. Over budget, the beam is halved for the
+            next frames until the trie fits, and widens back once the trie is under half the budget. Bounds the memory
+            of inputs such as noise with near uniform probabilities. The budget counts nodes, not bytes: the partial
+            hotwords of the nodes add to their fixed size. Default value is 0 i.e. no budget.
+        worker_pinning (str): Placement of the workers decoding the streams: "none" lets them run on any core, "core"
+            pins each worker to a core and "numa_node" to the cores of a NUMA node, spreading the workers over the nodes.
+            A pinned worker allocates the memory of its streams on its node. Default value is "none".
+        replicate_lexicon (bool): With pinned workers, give the streams a copy of the lexicon on the NUMA node of their
+            worker, at the cost of one copy of the lexicon per node. Default value is False.
+        commit_prefix (bool): After each chunk, commit the tokens shared by all the prefixes of the beam, which can't
+            change anymore, and free their part of the prefix trie, keeping only the context the language model needs.
+            Bounds the memory and the cost of the final decode of endless streams. The results keep the committed tokens
+            until they are taken with take_committed(). Default value is False.
+        deadline_ms (float): Time budget in milliseconds of the decoding of each chunk of a stream, or of the whole
+            stream with deadline_per_stream. The decoder narrows beam_width and cutoff_top_n when its pace would miss
+            the deadline, and skips the frames left once the deadline passes. Default value is 0 i.e. no deadline.
+        deadline_per_stream (bool): The deadline_ms budget starts with the first chunk of each stream and runs over all
+            its chunks, including the time between them, rather than restarting with each chunk. Default value is False.
     """
 
     def __init__(
@@ -293,6 +486,19 @@ class OnlineCTCBeamDecoder(object):
         lm_type: str = "character",
         token_separator: str = "#",
         lexicon_fst_path: Optional[str] = None,
+        shared_scorer_path: Optional[str] = None,
+        lm_load_method: str = "populate",
+        num_prune_threads: int = 0,
+        min_cutoff_top_n: int = 0,
+        adaptive_cutoff_scale: float = 2.0,
+        greedy_margin: float = 0.0,
+        lm_lookahead: bool = False,
+        max_trie_nodes: int = 0,
+        worker_pinning: str = "none",
+        replicate_lexicon: bool = False,
+        commit_prefix: bool = False,
+        deadline_ms: float = 0.0,
+        deadline_per_stream: bool = False,
     ):
         self._cutoff_top_n = cutoff_top_n
         self._beam_width = beam_width
@@ -303,6 +509,7 @@ class OnlineCTCBeamDecoder(object):
         self._blank_id = blank_id
         self._log_probs = 1 if log_probs_input else 0
         lexicon_fst_path = lexicon_fst_path if lexicon_fst_path is not None else ""
+        shared_scorer_path = shared_scorer_path if shared_scorer_path is not None else ""
 
         self.decoder_options = ctc_decode.paddle_get_decoder_options(
             self._labels,
@@ -316,6 +523,24 @@ class OnlineCTCBeamDecoder(object):
             unk_score,
             token_separator,
         )
+        if num_prune_threads:
+            ctc_decode.set_num_prune_threads(self.decoder_options, num_prune_threads)
+        if min_cutoff_top_n:
+            ctc_decode.set_adaptive_cutoff(
+                self.decoder_options, min_cutoff_top_n, adaptive_cutoff_scale
+            )
+        if greedy_margin:
+            ctc_decode.set_greedy_margin(self.decoder_options, greedy_margin)
+        if lm_lookahead:
+            ctc_decode.set_lm_lookahead(self.decoder_options, lm_lookahead)
+        if max_trie_nodes:
+            ctc_decode.set_max_trie_nodes(self.decoder_options, max_trie_nodes)
+        if worker_pinning != "none" or replicate_lexicon:
+            ctc_decode.set_worker_pinning(self.decoder_options, worker_pinning, replicate_lexicon)
+        if commit_prefix:
+            ctc_decode.set_commit_prefix(self.decoder_options, commit_prefix)
+        if deadline_ms:
+            ctc_decode.set_deadline(self.decoder_options, deadline_ms, deadline_per_stream)
 
         if model_path:
             self._scorer = ctc_decode.paddle_get_scorer(
@@ -325,6 +550,8 @@ class OnlineCTCBeamDecoder(object):
                 self._labels,
                 lm_type,
                 lexicon_fst_path.encode(),
+                shared_scorer_path.encode(),
+                lm_load_method,
             )
         self._cutoff_prob = cutoff_prob
 
@@ -388,6 +615,54 @@ class OnlineCTCBeamDecoder(object):
     def dict_size(self):
         return ctc_decode.get_dict_size(self._scorer) if self._scorer else None
 
+    def warmup(self, num_time_steps: int = 100):
+        """
+        Pre-faults the language model and lexicon memory and runs a synthetic decode, so that latency is
+        stable from the first real request.
+        Args:
+        num_time_steps (int) - Number of synthetic time steps to decode. ( default = 100 )
+        """
+        ctc_decode.paddle_warmup(self.decoder_options, self._scorer, num_time_steps)
+
+    def load_stats(self):
+        """
+        Returns the time in seconds spent in loading the language model and the lexicon, as a dict
+        with `lm_seconds`, `lexicon_seconds`, `hotword_seconds` and `total_seconds` keys.
+        """
+        return ctc_decode.get_scorer_load_stats(self._scorer) if self._scorer else None
+
+    def best_partial(self, states):
+        """
+        Returns the best transcription of each stream so far, without waiting for the end of the stream. It is much
+        cheaper than a decode with `is_eos_s` set, so it can be called after every chunk: it reads the best prefix of the
+        beam as it is, ranked without the language model score of its unfinished last word, and doesn't compute the
+        other beams.
+        Args:
+        states (Sequence[DecoderState]) - states of the streams.
+
+        Returns:
+        list: a (tokens, score, timesteps) tuple per stream, with 1-dim int tensors of the tokens, starting with the
+        committed tokens not taken yet, and of their timesteps, and the beam score of the transcription.
+        """
+        partials = []
+        for state in states:
+            tokens, score, timesteps = ctc_decode.paddle_best_partial(state.state)
+            partials.append((torch.IntTensor(tokens), score, torch.IntTensor(timesteps)))
+        return partials
+
+    def take_committed(self, state):
+        """
+        Takes the tokens committed by a stream since the last call, see `commit_prefix`. The results of the next
+        decodes of the stream no longer start with them.
+        Args:
+        state (DecoderState) - state of the stream.
+
+        Returns:
+        tuple: (tokens, timesteps), two 1-dim int tensors of the committed tokens and of their timesteps.
+        """
+        tokens, timesteps = ctc_decode.paddle_take_committed(state.state)
+        return torch.IntTensor(tokens), torch.IntTensor(timesteps)
+
     def reset_state(state):
         ctc_decode.paddle_release_state(state)
 
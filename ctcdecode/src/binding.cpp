@@ -6,6 +6,7 @@
 
 #include "ctc_beam_search_decoder.h"
 #include "decoder_options.h"
+#include "decoder_resources.h"
 #include "scorer.h"
 #include "utf8.h"
 
@@ -37,7 +38,8 @@ int paddle_beam_decode_with_lm_and_hotwords(at::Tensor th_probs,
                                             at::Tensor th_output,
                                             at::Tensor th_timesteps,
                                             at::Tensor th_scores,
-                                            at::Tensor th_out_length)
+                                            at::Tensor th_out_length,
+                                            at::Tensor th_degraded)
 {
 
     DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
@@ -81,6 +83,7 @@ int paddle_beam_decode_with_lm_and_hotwords(at::Tensor th_probs,
     auto timesteps_accessor = th_timesteps.accessor<int, 3>();
     auto scores_accessor = th_scores.accessor<float, 2>();
     auto out_length_accessor = th_out_length.accessor<int, 2>();
+    auto degraded_accessor = th_degraded.accessor<int, 1>();
 
     for (int b = 0; b < batch_results.size(); ++b) {
         std::vector<std::pair<double, Output>> results = batch_results[b];
@@ -95,6 +98,7 @@ int paddle_beam_decode_with_lm_and_hotwords(at::Tensor th_probs,
             }
             scores_accessor[b][p] = n_path_result.first;
             out_length_accessor[b][p] = output_tokens.size();
+            degraded_accessor[b] = output.degraded;
         }
     }
     return 1;
@@ -106,7 +110,8 @@ int paddle_beam_decode(at::Tensor th_probs,
                        at::Tensor th_output,
                        at::Tensor th_timesteps,
                        at::Tensor th_scores,
-                       at::Tensor th_out_length)
+                       at::Tensor th_out_length,
+                       at::Tensor th_degraded)
 {
 
     return paddle_beam_decode_with_lm_and_hotwords(th_probs,
@@ -117,7 +122,8 @@ int paddle_beam_decode(at::Tensor th_probs,
                                                    th_output,
                                                    th_timesteps,
                                                    th_scores,
-                                                   th_out_length);
+                                                   th_out_length,
+                                                   th_degraded);
 }
 
 int paddle_beam_decode_with_lm(at::Tensor th_probs,
@@ -127,7 +133,8 @@ int paddle_beam_decode_with_lm(at::Tensor th_probs,
                                at::Tensor th_output,
                                at::Tensor th_timesteps,
                                at::Tensor th_scores,
-                               at::Tensor th_out_length)
+                               at::Tensor th_out_length,
+                               at::Tensor th_degraded)
 {
 
     return paddle_beam_decode_with_lm_and_hotwords(th_probs,
@@ -138,7 +145,8 @@ int paddle_beam_decode_with_lm(at::Tensor th_probs,
                                                    th_output,
                                                    th_timesteps,
                                                    th_scores,
-                                                   th_out_length);
+                                                   th_out_length,
+                                                   th_degraded);
 }
 
 int paddle_beam_decode_with_hotwords(at::Tensor th_probs,
@@ -148,7 +156,8 @@ int paddle_beam_decode_with_hotwords(at::Tensor th_probs,
                                      at::Tensor th_output,
                                      at::Tensor th_timesteps,
                                      at::Tensor th_scores,
-                                     at::Tensor th_out_length)
+                                     at::Tensor th_out_length,
+                                     at::Tensor th_degraded)
 {
 
     return paddle_beam_decode_with_lm_and_hotwords(th_probs,
@@ -159,7 +168,8 @@ int paddle_beam_decode_with_hotwords(at::Tensor th_probs,
                                                    th_output,
                                                    th_timesteps,
                                                    th_scores,
-                                                   th_out_length);
+                                                   th_out_length,
+                                                   th_degraded);
 }
 
 void* paddle_get_decoder_options(std::vector<std::string> vocab,
@@ -191,9 +201,12 @@ void* paddle_get_scorer(double alpha,
                         const char* lm_path,
                         std::vector<std::string> new_vocab,
                         std::string lm_type,
-                        const char* fst_path)
+                        const char* fst_path,
+                        const char* shared_path,
+                        std::string load_method)
 {
-    Scorer* scorer = new Scorer(alpha, beta, lm_path, new_vocab, lm_type, fst_path);
+    Scorer* scorer = new Scorer(
+        alpha, beta, lm_path, new_vocab, lm_type, fst_path, shared_path, load_method);
     return static_cast<void*>(scorer);
 }
 
@@ -208,6 +221,66 @@ void* get_hotword_scorer(void* decoder_options,
     return static_cast<void*>(scorer);
 }
 
+void paddle_warmup(void* decoder_options, void* scorer, size_t num_time_steps)
+{
+    DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
+    Scorer* ext_scorer = nullptr;
+    if (scorer != nullptr) {
+        ext_scorer = static_cast<Scorer*>(scorer);
+    }
+    py::gil_scoped_release release;
+    ctc_beam_search_warmup(options, ext_scorer, nullptr, num_time_steps);
+}
+
+std::map<std::string, double> load_stats_to_map(const LoadStats& stats)
+{
+    return { { "lm_seconds", stats.lm_seconds },
+             { "lexicon_seconds", stats.lexicon_seconds },
+             { "hotword_seconds", stats.hotword_seconds },
+             { "total_seconds", stats.total_seconds } };
+}
+
+std::tuple<void*, void*, std::map<std::string, double>>
+paddle_load_decoder_resources(void* decoder_options,
+                              double alpha,
+                              double beta,
+                              std::string lm_path,
+                              std::string lm_type,
+                              std::string fst_path,
+                              std::string shared_path,
+                              std::string load_method,
+                              std::vector<std::vector<std::string>> hotwords,
+                              std::vector<float> hotword_weights)
+{
+    DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
+    std::future<DecoderResources> loader = load_decoder_resources_async(options,
+                                                                        alpha,
+                                                                        beta,
+                                                                        lm_path,
+                                                                        lm_type,
+                                                                        fst_path,
+                                                                        shared_path,
+                                                                        load_method,
+                                                                        hotwords,
+                                                                        hotword_weights);
+
+    DecoderResources resources;
+    {
+        // let other python threads run while the resources are being loaded
+        py::gil_scoped_release release;
+        resources = loader.get();
+    }
+    return { static_cast<void*>(resources.scorer),
+             static_cast<void*>(resources.hotword_scorer),
+             load_stats_to_map(resources.stats) };
+}
+
+std::map<std::string, double> get_scorer_load_stats(void* scorer)
+{
+    Scorer* ext_scorer = static_cast<Scorer*>(scorer);
+    return load_stats_to_map(ext_scorer->get_load_stats());
+}
+
 std::pair<torch::Tensor, torch::Tensor>
 beam_decode_with_given_state(at::Tensor th_probs,
                              at::Tensor th_seq_lens,
@@ -353,6 +426,104 @@ void reset_params(void* scorer, double alpha, double beta)
     ext_scorer->reset_params(alpha, beta);
 }
 
+void set_num_prune_threads(void* decoder_options, size_t num_prune_threads)
+{
+    DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
+    options->num_prune_threads = num_prune_threads;
+}
+
+void set_adaptive_cutoff(void* decoder_options, size_t min_cutoff_top_n, double scale)
+{
+    DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
+    options->min_cutoff_top_n = min_cutoff_top_n;
+    options->adaptive_cutoff_scale = scale;
+}
+
+void set_greedy_margin(void* decoder_options, double greedy_margin)
+{
+    DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
+    options->greedy_margin = greedy_margin;
+}
+
+void set_lm_lookahead(void* decoder_options, bool lm_lookahead)
+{
+    DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
+    options->lm_lookahead = lm_lookahead;
+}
+
+void set_long_form_segmentation(void* decoder_options,
+                                size_t min_pause,
+                                double blank_prob,
+                                size_t context_frames,
+                                bool carry_context)
+{
+    DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
+    options->segment_min_pause = min_pause;
+    options->segment_blank_prob = blank_prob;
+    options->segment_context_frames = context_frames;
+    options->segment_carry_context = carry_context;
+}
+
+void set_lockstep_batch(void* decoder_options, bool lockstep_batch)
+{
+    DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
+    options->lockstep_batch = lockstep_batch;
+}
+
+void set_offline_priority(void* decoder_options, bool offline_priority, size_t preemption_frames)
+{
+    DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
+    options->offline_priority = offline_priority;
+    options->preemption_frames = preemption_frames;
+}
+
+void set_deadline(void* decoder_options, double deadline_ms, bool per_stream)
+{
+    DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
+    options->deadline_ms = deadline_ms;
+    options->deadline_scope = per_stream ? DeadlineScope::STREAM : DeadlineScope::CHUNK;
+}
+
+void set_max_trie_nodes(void* decoder_options, size_t max_trie_nodes)
+{
+    DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
+    options->max_trie_nodes = max_trie_nodes;
+}
+
+void set_commit_prefix(void* decoder_options, bool commit_prefix)
+{
+    DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
+    options->commit_prefix = commit_prefix;
+}
+
+std::pair<std::vector<int>, std::vector<int>> paddle_take_committed(void* state)
+{
+    Output committed = static_cast<DecoderState*>(state)->take_committed();
+    return { committed.tokens, committed.timesteps };
+}
+
+std::tuple<std::vector<int>, double, std::vector<int>> paddle_best_partial(void* state)
+{
+    std::pair<double, Output> best = static_cast<DecoderState*>(state)->best_partial();
+    return std::make_tuple(best.second.tokens, best.first, best.second.timesteps);
+}
+
+static std::map<std::string, WorkerPinning> StringToWorkerPinning
+    = { { "none", WorkerPinning::NONE },
+        { "core", WorkerPinning::CORE },
+        { "numa_node", WorkerPinning::NUMA_NODE } };
+
+void set_worker_pinning(void* decoder_options,
+                        const std::string& worker_pinning,
+                        bool replicate_lexicon)
+{
+    auto pinning = StringToWorkerPinning.find(worker_pinning);
+    VALID_CHECK(pinning != StringToWorkerPinning.end(), "Invalid worker pinning");
+    DecoderOptions* options = static_cast<DecoderOptions*>(decoder_options);
+    options->worker_pinning = pinning->second;
+    options->replicate_lexicon = replicate_lexicon;
+}
+
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
 {
     m.def("paddle_beam_decode", &paddle_beam_decode, "paddle_beam_decode");
@@ -375,6 +546,16 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
     m.def("paddle_get_decoder_options", &paddle_get_decoder_options, "paddle_get_decoder_options");
     m.def("paddle_get_scorer", &paddle_get_scorer, "paddle_get_scorer");
     m.def("get_hotword_scorer", &get_hotword_scorer, "get_hotword_scorer");
+    m.def("paddle_load_decoder_resources",
+          &paddle_load_decoder_resources,
+          "paddle_load_decoder_resources");
+    m.def("get_scorer_load_stats", &get_scorer_load_stats, "get_scorer_load_stats");
+    m.def("paddle_warmup",
+          &paddle_warmup,
+          "paddle_warmup",
+          py::arg("decoder_options"),
+          py::arg("scorer").none(true),
+          py::arg("num_time_steps"));
     m.def("paddle_release_scorer", &paddle_release_scorer, "paddle_release_scorer");
     m.def("paddle_release_decoder_options",
           &paddle_release_decoder_options,
@@ -386,10 +567,23 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
     m.def("get_max_order", &get_max_order, "get_max_order");
     m.def("get_lexicon_size", &get_lexicon_size, "get_max_order");
     m.def("reset_params", &reset_params, "reset_params");
+    m.def("set_num_prune_threads", &set_num_prune_threads, "set_num_prune_threads");
+    m.def("set_adaptive_cutoff", &set_adaptive_cutoff, "set_adaptive_cutoff");
+    m.def("set_greedy_margin", &set_greedy_margin, "set_greedy_margin");
+    m.def("set_lm_lookahead", &set_lm_lookahead, "set_lm_lookahead");
+    m.def("set_long_form_segmentation", &set_long_form_segmentation, "set_long_form_segmentation");
+    m.def("set_lockstep_batch", &set_lockstep_batch, "set_lockstep_batch");
+    m.def("set_worker_pinning", &set_worker_pinning, "set_worker_pinning");
+    m.def("set_offline_priority", &set_offline_priority, "set_offline_priority");
+    m.def("set_deadline", &set_deadline, "set_deadline");
+    m.def("set_max_trie_nodes", &set_max_trie_nodes, "set_max_trie_nodes");
+    m.def("set_commit_prefix", &set_commit_prefix, "set_commit_prefix");
     m.def("paddle_get_decoder_state", &paddle_get_decoder_state, "paddle_get_decoder_state");
     m.def("paddle_beam_decode_with_given_state",
           &paddle_beam_decode_with_given_state,
           "paddle_beam_decode_with_given_state");
     m.def("paddle_release_state", &paddle_release_state, "paddle_release_state");
+    m.def("paddle_take_committed", &paddle_take_committed, "paddle_take_committed");
+    m.def("paddle_best_partial", &paddle_best_partial, "paddle_best_partial");
     // paddle_beam_decode_with_given_state
 }
@@ -50,13 +50,31 @@ void* paddle_get_scorer(double alpha,
                         const char* lm_path,
                         std::vector<std::string> labels,
                         std::string lm_type,
-                        const char* fst_path);
+                        const char* fst_path,
+                        const char* shared_path,
+                        std::string load_method);
+
+void paddle_warmup(void* decoder_options, void* scorer, size_t num_time_steps);
 
 void* get_hotword_scorer(void* decoder_options,
                          std::vector<std::vector<std::string>> hotwords,
                          std::vector<float> hotword_weights,
                          char token_separator);
 
+std::tuple<void*, void*, std::map<std::string, double>>
+paddle_load_decoder_resources(void* decoder_options,
+                              double alpha,
+                              double beta,
+                              std::string lm_path,
+                              std::string lm_type,
+                              std::string fst_path,
+                              std::string shared_path,
+                              std::string load_method,
+                              std::vector<std::vector<std::string>> hotwords,
+                              std::vector<float> hotword_weights);
+
+std::map<std::string, double> get_scorer_load_stats(void* scorer);
+
 void* paddle_get_decoder_state(void* decoder_options, void* scorer);
 
 void paddle_release_scorer(void* scorer);
@@ -68,3 +86,22 @@ int is_character_based(void* scorer);
 size_t get_max_order(void* scorer);
 size_t get_lexicon_size(void* scorer);
 void reset_params(void* scorer, double alpha, double beta);
+void set_num_prune_threads(void* decoder_options, size_t num_prune_threads);
+void set_adaptive_cutoff(void* decoder_options, size_t min_cutoff_top_n, double scale);
+void set_greedy_margin(void* decoder_options, double greedy_margin);
+void set_lm_lookahead(void* decoder_options, bool lm_lookahead);
+void set_long_form_segmentation(void* decoder_options,
+                                size_t min_pause,
+                                double blank_prob,
+                                size_t context_frames,
+                                bool carry_context);
+void set_lockstep_batch(void* decoder_options, bool lockstep_batch);
+void set_offline_priority(void* decoder_options, bool offline_priority, size_t preemption_frames);
+void set_deadline(void* decoder_options, double deadline_ms, bool per_stream);
+void set_max_trie_nodes(void* decoder_options, size_t max_trie_nodes);
+void set_commit_prefix(void* decoder_options, bool commit_prefix);
+std::pair<std::vector<int>, std::vector<int>> paddle_take_committed(void* state);
+std::tuple<std::vector<int>, double, std::vector<int>> paddle_best_partial(void* state);
+void set_worker_pinning(void* decoder_options,
+                        const std::string& worker_pinning,
+                        bool replicate_lexicon);
@@ -1,13 +1,16 @@
 #include "ctc_beam_search_decoder.h"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <map>
+#include <random>
 
 #include "ThreadPool.h"
 #include "decoder_utils.h"
 #include "fst/fstlib.h"
 #include "path_trie.h"
+#include "stream_worker_pool.h"
 
 using FSTMATCH = fst::SortedMatcher<fst::StdVectorFst>;
 
@@ -19,32 +22,32 @@ DecoderState::DecoderState(DecoderOptions* options,
     , ext_scorer(ext_scorer)
     , hotword_scorer(hotword_scorer)
 {
-    space_id = -2;
-    apostrophe_id = -3;
-
-    // assign space id and apostrophe id if present in vocabulary
-    int id = 0;
-    for (auto it = options->vocab.begin(); it != options->vocab.end(); ++it) {
-        if (*it == " ") {
-            space_id = id;
-        } else if (*it == "'") {
-            apostrophe_id = id;
-        }
-        ++id;
-    }
+    space_id = options->space_id;
+    apostrophe_id = options->apostrophe_id;
 
     // init prefixes' root
+    root.set_pool(&node_pool);
     root.score = root.log_prob_b_prev = 0.0;
     root.score_hw = root.log_prob_b_prev_hw = 0.0;
     prefixes.push_back(&root);
+    worst_beam_score = root.score_hw;
+    best_prefix = &root;
+    greedy_span = false;
+    frame_beam_width = options->beam_width;
+    home_worker = std::numeric_limits<size_t>::max();
+    deadline_beam_width = options->beam_width;
+    deadline_cutoff_top_n = options->cutoff_top_n;
+    deadline_started = false;
+    degraded = false;
+    budget_beam_width = options->beam_width;
+    frames_since_yield = 0;
+    lm_lookahead = options->lm_lookahead && ext_scorer != nullptr && ext_scorer->has_lookahead();
 
     if (ext_scorer != nullptr && ext_scorer->has_lexicon()) {
-
-        auto fst_dict = static_cast<fst::StdVectorFst*>(ext_scorer->lexicon);
-        fst::StdVectorFst* dict_ptr = fst_dict->Copy(true);
-        root.set_lexicon(dict_ptr);
-        auto matcher
-            = std::make_shared<fst::SortedMatcher<fst::StdVectorFst>>(*dict_ptr, fst::MATCH_INPUT);
+        // the lexicon is immutable, so all the states share the scorer's copy
+        auto fst_dict = static_cast<const LexiconFst*>(ext_scorer->lexicon);
+        root.set_lexicon(fst_dict);
+        auto matcher = std::make_shared<LexiconMatcher>(*fst_dict, fst::MATCH_INPUT);
         root.set_matcher(matcher);
     }
 
@@ -53,6 +56,56 @@ DecoderState::DecoderState(DecoderOptions* options,
             = std::make_shared<FSTMATCH>(hotword_scorer->dictionary, fst::MATCH_INPUT);
         root.hotword_matcher = hotword_matcher;
     }
+
+    unsigned features = 0;
+    if (ext_scorer != nullptr) {
+        features |= FEATURE_SCORER;
+        if (ext_scorer->has_lexicon()) {
+            features |= FEATURE_LEXICON;
+        }
+        if (ext_scorer->is_character_based() || ext_scorer->is_bpe_based()) {
+            features |= FEATURE_SUBWORD_LM;
+        }
+    }
+    if (hotword_scorer != nullptr) {
+        features |= FEATURE_HOTWORDS;
+    }
+    if (options->is_bpe_based) {
+        features |= FEATURE_BPE;
+    }
+    expand_frame_function = select_expand_function(features);
+}
+
+DecoderState::~DecoderState() = default;
+
+void DecoderState::use_lexicon_replica(size_t node)
+{
+    if (abs_time_step != 0 || ext_scorer == nullptr || !ext_scorer->has_lexicon()) {
+        return;
+    }
+    const LexiconFst* lexicon = ext_scorer->get_lexicon_replica(node);
+    root.set_lexicon(lexicon);
+    root.set_matcher(std::make_shared<LexiconMatcher>(*lexicon, fst::MATCH_INPUT));
+}
+
+template <size_t... Features>
+constexpr std::array<DecoderState::ExpandFunction, sizeof...(Features)>
+DecoderState::make_expand_functions(std::index_sequence<Features...>)
+{
+    return { { &DecoderState::expand_frame<Features>... } };
+}
+
+/**
+ * @brief Returns the expansion of a frame compiled for the given set of features
+ *
+ * @param features, bitmask of DecoderState::Feature
+ * @return pointer to the specialized DecoderState::expand_frame
+ */
+DecoderState::ExpandFunction DecoderState::select_expand_function(unsigned features)
+{
+    static constexpr auto expand_functions
+        = make_expand_functions(std::make_index_sequence<NUM_FEATURE_SETS>());
+    return expand_functions[features];
 }
 
 /**
@@ -63,28 +116,27 @@ DecoderState::DecoderState(DecoderOptions* options,
  * @return true, if the current node's character/token can start a word
  * @return false, if the current node's character/token cannot start a word
  */
+template <unsigned Features>
 bool DecoderState::is_start_of_word(PathTrie* path)
 {
-
-    bool is_bpe_based_start_token = options->is_bpe_based
-                                    && !is_mergeable_bpe_token(options->vocab[path->character],
-                                                               path->character,
-                                                               path->parent->character,
-                                                               apostrophe_id,
-                                                               options->token_separator);
-
-    bool is_char_based_start_token
-        = !options->is_bpe_based
-          && (path->parent->character == space_id || path->parent->character == -1);
-
-    return is_bpe_based_start_token || is_char_based_start_token;
+    int parent_char = path->parent->character;
+    if constexpr ((Features & FEATURE_BPE) != 0) {
+        // the token starts a word unless it merges with the parent token
+        const TokenAttributes& attributes = options->token_attributes[path->character];
+        bool is_mergeable = attributes.is_bpe_continuation() || attributes.is_apostrophe()
+                            || (parent_char >= 0
+                                && options->token_attributes[parent_char].is_apostrophe());
+        return !is_mergeable;
+    } else {
+        return parent_char < 0 || options->token_attributes[parent_char].is_space();
+    }
 }
 
 /**
  * @brief Updates both original and hotword non-blank scores of the current path node. If the
  current ends a
  * hotword then the original score (log_p) is updated with the actual score (log_p_hw, contains both
- original and hotword scores)
+ original and hotword scores). Without hotwords, only the original score is updated.
  *
  * @param path, PathTrie node
  * @param log_prob_c, log probablity of the node
@@ -92,10 +144,24 @@ bool DecoderState::is_start_of_word(PathTrie* path)
  * @param reset_score, whether to consider previous node's original score instead of original +
  hotword score . Score resetting happens when partial hotword is formed
  */
+template <unsigned Features>
 void DecoderState::update_score(PathTrie* path, float log_prob_c, float lm_score, bool reset_score)
 {
     float log_p_lm_score = log_prob_c + lm_score;
 
+    if constexpr ((Features & FEATURE_HOTWORDS) == 0) {
+        float log_p = -NUM_FLT_INF;
+        if (path->character == path->parent->character) {
+            if (path->parent->log_prob_b_prev > -NUM_FLT_INF) {
+                log_p = log_p_lm_score + path->parent->log_prob_b_prev;
+            }
+        } else {
+            log_p = log_p_lm_score + path->parent->score;
+        }
+        path->log_prob_nb_cur = log_sum_exp(path->log_prob_nb_cur, log_p);
+        return;
+    }
+
     float log_p = -NUM_FLT_INF;
     float log_p_hw = -NUM_FLT_INF;
 
@@ -152,158 +218,768 @@ void DecoderState::next(const std::vector<std::vector<double>>& probs_seq)
                        "the shape of the vocabulary");
     }
 
+    bool has_deadline = options->deadline_ms > 0.0;
+    if (has_deadline) {
+        start_deadline();
+    }
+
+    if (options->num_prune_threads > 0 && num_time_steps > PRUNE_CHUNK_SIZE) {
+        next_pipelined(probs_seq, has_deadline);
+    } else {
+        next_serial(probs_seq, has_deadline);
+    }
+
+    if (options->commit_prefix) {
+        commit_common_prefix();
+    }
+}
+
+void DecoderState::next_serial(const std::vector<std::vector<double>>& probs_seq,
+                               bool has_deadline)
+{
+    size_t num_time_steps = probs_seq.size();
+
     // prefix search over time
-    for (size_t time_step = 0; time_step < num_time_steps; ++time_step, ++abs_time_step) {
+    for (size_t time_step = 0; time_step < num_time_steps; ++time_step) {
+        if (has_deadline && !meet_deadline(time_step, num_time_steps)) {
+            // the skipped frames keep their place in the timesteps of the stream
+            abs_time_step += num_time_steps - time_step;
+            break;
+        }
         auto& prob = probs_seq[time_step];
+        advance_frame(prob, prune_frame(prob, has_deadline));
+        count_preemption_frame();
+    } // end of loop over time
+}
+
+const std::vector<std::pair<size_t, float>>&
+DecoderState::prune_frame(const std::vector<double>& prob, bool has_deadline)
+{
+    size_t cutoff_top_n = has_deadline ? deadline_cutoff_top_n : options->cutoff_top_n;
+    get_pruned_log_probs(prob,
+                         options->cutoff_prob,
+                         cutoff_top_n,
+                         options->log_probs_input,
+                         scratch.prob_idx,
+                         scratch.log_prob_idx,
+                         std::min(options->min_cutoff_top_n, cutoff_top_n),
+                         options->adaptive_cutoff_scale);
+    return scratch.log_prob_idx;
+}
+
+void DecoderState::count_preemption_frame()
+{
+    if (options->preemption_frames > 0 && ++frames_since_yield >= options->preemption_frames) {
+        frames_since_yield = 0;
+        StreamWorkerPool::yield();
+    }
+}
+
+/**
+ * @brief Runs the beam search over frames pruned ahead by a pruning stage. Pruning a frame
+ * doesn't depend on the beam, so chunks of upcoming frames are pruned in parallel on the pool
+ * while the beam search consumes the chunks in order. A ring of 2 chunks per thread bounds the
+ * memory held by the frames pruned ahead.
+ *
+ * @param probs_seq, probabilities over the vocabulary of each time step
+ * @param has_deadline, whether the frames are decoded within DecoderOptions::deadline_ms
+ */
+void DecoderState::next_pipelined(const std::vector<std::vector<double>>& probs_seq,
+                                  bool has_deadline)
+{
+    if (prune_pool == nullptr) {
+        prune_pool.reset(new ThreadPool(options->num_prune_threads));
+    }
+
+    size_t num_time_steps = probs_seq.size();
+    size_t num_chunks = (num_time_steps + PRUNE_CHUNK_SIZE - 1) / PRUNE_CHUNK_SIZE;
+    size_t window = std::min(num_chunks, 2 * options->num_prune_threads);
+    if (pruned_chunks.size() < window) {
+        pruned_chunks.resize(window);
+    }
+
+    auto prune_chunk = [&](size_t chunk) {
+        PrunedChunk& pruned_chunk = pruned_chunks[chunk % window];
+        size_t begin = chunk * PRUNE_CHUNK_SIZE;
+        size_t end = std::min(begin + PRUNE_CHUNK_SIZE, num_time_steps);
+        pruned_chunk.log_prob_idx.resize(end - begin);
+        for (size_t time_step = begin; time_step < end; ++time_step) {
+            get_pruned_log_probs(probs_seq[time_step],
+                                 options->cutoff_prob,
+                                 options->cutoff_top_n,
+                                 options->log_probs_input,
+                                 pruned_chunk.prob_idx,
+                                 pruned_chunk.log_prob_idx[time_step - begin],
+                                 options->min_cutoff_top_n,
+                                 options->adaptive_cutoff_scale);
+        }
+    };
+
+    std::vector<std::future<void>> pruned(window);
+    for (size_t chunk = 0; chunk < window; ++chunk) {
+        pruned[chunk] = prune_pool->enqueue(prune_chunk, chunk);
+    }
+
+    // prefix search over time
+    bool missed_deadline = false;
+    for (size_t chunk = 0; chunk < num_chunks; ++chunk) {
+        if (missed_deadline) {
+            // wait for the chunks being pruned ahead, which use the ring
+            if (pruned[chunk % window].valid()) {
+                pruned[chunk % window].get();
+            }
+            continue;
+        }
+        pruned[chunk % window].get();
+
+        const PrunedChunk& pruned_chunk = pruned_chunks[chunk % window];
+        size_t begin = chunk * PRUNE_CHUNK_SIZE;
+        for (size_t i = 0; i < pruned_chunk.log_prob_idx.size(); ++i) {
+            if (has_deadline && !meet_deadline(begin + i, num_time_steps)) {
+                abs_time_step += num_time_steps - (begin + i);
+                missed_deadline = true;
+                break;
+            }
+            const auto* log_prob_idx = &pruned_chunk.log_prob_idx[i];
+            if (has_deadline && deadline_cutoff_top_n < log_prob_idx->size()) {
+                // the frames are pruned ahead with the full cutoff_top_n, keep the best of them
+                // within the narrowed one
+                scratch.log_prob_idx.assign(log_prob_idx->begin(), log_prob_idx->end());
+                std::partial_sort(scratch.log_prob_idx.begin(),
+                                  scratch.log_prob_idx.begin() + deadline_cutoff_top_n,
+                                  scratch.log_prob_idx.end(),
+                                  pair_comp_second_rev<size_t, float>);
+                scratch.log_prob_idx.resize(deadline_cutoff_top_n);
+                log_prob_idx = &scratch.log_prob_idx;
+            }
+            advance_frame(probs_seq[begin + i], *log_prob_idx);
+            count_preemption_frame();
+        }
+
+        // the slot of the chunk is free, prune the next chunk into it
+        if (!missed_deadline && chunk + window < num_chunks) {
+            pruned[chunk % window] = prune_pool->enqueue(prune_chunk, chunk + window);
+        }
+    } // end of loop over time
+}
+
+void DecoderState::start_deadline()
+{
+    window_start_time = std::chrono::steady_clock::now();
+    if (options->deadline_scope == DeadlineScope::STREAM && deadline_started) {
+        // the wait for this chunk is not part of the time per frame
+        return;
+    }
+    deadline_started = true;
+    deadline = window_start_time
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double, std::milli>(options->deadline_ms));
+    deadline_beam_width = options->beam_width;
+    deadline_cutoff_top_n = options->cutoff_top_n;
+    degraded = false;
+}
+
+bool DecoderState::meet_deadline(size_t time_step, size_t num_time_steps)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+        degraded = true;
+        return false;
+    }
+    if (time_step == 0 || time_step % DEADLINE_WINDOW_SIZE != 0) {
+        return true;
+    }
+
+    // project the remaining frames at the time per frame of the last window, which reflects
+    // the current widths
+    double window_seconds = std::chrono::duration<double>(now - window_start_time).count();
+    double seconds_left = std::chrono::duration<double>(deadline - now).count();
+    double projected_seconds
+        = window_seconds / DEADLINE_WINDOW_SIZE * (num_time_steps - time_step);
+    window_start_time = now;
+    if (projected_seconds > seconds_left) {
+        // the time of a frame grows with the product of the beam width and the number of
+        // candidates, so each of them is narrowed by the square root of the shortfall
+        double scale = std::sqrt(seconds_left / projected_seconds);
+        deadline_beam_width
+            = std::max<size_t>(1, static_cast<size_t>(deadline_beam_width * scale));
+        deadline_cutoff_top_n
+            = std::max<size_t>(1, static_cast<size_t>(deadline_cutoff_top_n * scale));
+        degraded = true;
+    }
+    return true;
+}
+
+void DecoderState::advance_frame(const std::vector<double>& prob,
+                                 const std::vector<std::pair<size_t, float>>& log_prob_idx)
+{
+    begin_frame(prob, log_prob_idx);
+    score_lm_queries();
+    end_frame();
+}
+
+/**
+ * @brief Advances the given states one frame at a time, all of them in the same frame. The
+ * beams of all the states are gathered in the same arrays for the blank and repeat updates of
+ * a frame, and its language model queries are gathered from all the states and scored in one
+ * batch, so that the updates and the backend amortize their per-call cost over the whole batch
+ * rather than over one utterance. Each state keeps its own deadline, yields and commits, as in
+ * next().
+ *
+ * @param states, states of the utterances, sharing the same scorer and hotword scorer
+ * @param probs_seqs, probabilities over the vocabulary of each time step of each utterance
+ */
+void DecoderState::next_lockstep(
+    const std::vector<DecoderState*>& states,
+    const std::vector<const std::vector<std::vector<double>>*>& probs_seqs)
+{
+    Scorer* ext_scorer = states.empty() ? nullptr : states[0]->ext_scorer;
+    HotwordScorer* hotword_scorer = states.empty() ? nullptr : states[0]->hotword_scorer;
+    size_t num_time_steps = 0;
+    for (size_t i = 0; i < states.size(); ++i) {
+        VALID_CHECK(states[i]->ext_scorer == ext_scorer, "The states must share their scorer");
+        VALID_CHECK(states[i]->hotword_scorer == hotword_scorer,
+                    "The states must share their hotword scorer");
+        for (const auto& prob : *probs_seqs[i]) {
+            VALID_CHECK_EQ(prob.size(),
+                           states[i]->options->vocab.size(),
+                           "The shape of probs_seq does not match with "
+                           "the shape of the vocabulary");
+        }
+        num_time_steps = std::max(num_time_steps, probs_seqs[i]->size());
+        if (states[i]->options->deadline_ms > 0.0) {
+            states[i]->start_deadline();
+        }
+    }
+
+    std::vector<size_t> active;
+    // the states whose deadline passed, and whose remaining frames are skipped
+    std::vector<char> missed_deadline(states.size(), 0);
+    std::vector<const std::vector<std::pair<size_t, float>>*> candidates(states.size());
+    std::vector<size_t> offsets(states.size());
+    DecoderScratch::BeamScores beam;
+    NgramBatch queries;
+    std::vector<double> scores;
+    LmBatchScratch lm_batch;
+    for (size_t time_step = 0; time_step < num_time_steps; ++time_step) {
+        active.clear();
+        for (size_t i = 0; i < states.size(); ++i) {
+            DecoderState* state = states[i];
+            size_t state_time_steps = probs_seqs[i]->size();
+            if (time_step >= state_time_steps || missed_deadline[i]) {
+                continue;
+            }
+            if (state->options->deadline_ms > 0.0
+                && !state->meet_deadline(time_step, state_time_steps)) {
+                // the skipped frames keep their place in the timesteps of the stream
+                state->abs_time_step += state_time_steps - time_step;
+                missed_deadline[i] = 1;
+                continue;
+            }
+            active.push_back(i);
+        }
+        if (active.empty()) {
+            break;
+        }
+
+        // select the candidates of every utterance, and give each of their beams its slots
+        size_t num_slots = 0;
+        for (size_t i : active) {
+            DecoderState* state = states[i];
+            const std::vector<double>& prob = (*probs_seqs[i])[time_step];
+            bool has_deadline = state->options->deadline_ms > 0.0;
+            candidates[i] = &state->select_candidates(prob, state->prune_frame(prob, has_deadline));
+            offsets[i] = num_slots;
+            num_slots += state->num_beam_slots();
+        }
+
+        // update the blanks and repeats of all the beams together, then expand each frame
+        beam.resize(num_slots);
+        for (size_t i : active) {
+            states[i]->gather_beam_scores(
+                (*probs_seqs[i])[time_step], *candidates[i], beam, offsets[i]);
+        }
+        if (hotword_scorer != nullptr) {
+            update_blanks_and_repeats<true>(beam, num_slots);
+        } else {
+            update_blanks_and_repeats<false>(beam, num_slots);
+        }
+        for (size_t i : active) {
+            DecoderState* state = states[i];
+            (state->*(state->expand_frame_function))(*candidates[i], beam, offsets[i]);
+        }
 
-        float min_cutoff = -NUM_FLT_INF;
-        bool full_beam = false;
+        // score the queries of all the utterances in one batch
         if (ext_scorer != nullptr) {
-            size_t num_prefixes = std::min(prefixes.size(), options->beam_width);
-            std::sort(prefixes.begin(), prefixes.begin() + num_prefixes, prefix_compare);
-            float blank_prob = options->log_probs_input ? prob[options->blank_id]
-                                                        : std::log(prob[options->blank_id]);
-            min_cutoff = prefixes[num_prefixes - 1]->score_hw + blank_prob
-                         - std::max(0.0, ext_scorer->beta);
-            full_beam = (num_prefixes == options->beam_width);
+            queries.clear();
+            for (size_t i : active) {
+                queries.append(states[i]->lm_queries);
+            }
+            if (!queries.empty()) {
+                ext_scorer->get_log_cond_probs(queries, scores, lm_batch);
+            }
+            size_t query = 0;
+            for (size_t i : active) {
+                DecoderState* state = states[i];
+                size_t num_queries = state->lm_queries.size();
+                state->lm_query_scores.assign(scores.begin() + query,
+                                              scores.begin() + query + num_queries);
+                query += num_queries;
+            }
         }
 
-        std::vector<std::pair<size_t, float>> log_prob_idx = get_pruned_log_probs(
-            prob, options->cutoff_prob, options->cutoff_top_n, options->log_probs_input);
+        for (size_t i : active) {
+            states[i]->end_frame();
+            states[i]->count_preemption_frame();
+        }
+    }
+
+    for (DecoderState* state : states) {
+        if (state->options->commit_prefix) {
+            state->commit_common_prefix();
+        }
+    }
+}
 
-        // loop over chars
-        for (size_t index = 0; index < log_prob_idx.size(); ++index) {
-            auto c = log_prob_idx[index].first;
-            auto log_prob_c = log_prob_idx[index].second;
+/**
+ * @brief Extends the prefixes with the tokens of a frame. The paths completing an n-gram are
+ * left waiting for its language model score, see end_frame().
+ *
+ * @param prob, probabilities over the vocabulary of one time step
+ * @param log_prob_idx, tokens of the time step kept by the pruning, with their log probability
+ */
+void DecoderState::begin_frame(const std::vector<double>& prob,
+                               const std::vector<std::pair<size_t, float>>& log_prob_idx)
+{
+    const std::vector<std::pair<size_t, float>>& candidates = select_candidates(prob, log_prob_idx);
 
-            for (size_t i = 0; i < prefixes.size() && i < options->beam_width; ++i) {
+    // the blank and repeat updates of the beam alone, in the slots of the state's scratch
+    DecoderScratch::BeamScores& beam = scratch.beam;
+    size_t num_slots = num_beam_slots();
+    beam.resize(num_slots);
+    gather_beam_scores(prob, candidates, beam, 0);
+    if (hotword_scorer != nullptr) {
+        update_blanks_and_repeats<true>(beam, num_slots);
+    } else {
+        update_blanks_and_repeats<false>(beam, num_slots);
+    }
 
-                auto prefix = prefixes[i];
+    (this->*expand_frame_function)(candidates, beam, 0);
+}
 
-                if (full_beam && log_prob_c + prefix->score_hw < min_cutoff) {
-                    break;
-                }
-                // blank
-                if (c == options->blank_id) {
-                    prefix->log_prob_b_cur
-                        = log_sum_exp(prefix->log_prob_b_cur, log_prob_c + prefix->score);
-                    prefix->log_prob_b_cur_hw
-                        = log_sum_exp(prefix->log_prob_b_cur_hw, log_prob_c + prefix->score_hw);
-                    continue;
-                }
+/**
+ * @brief Selects the tokens expanded in a frame: the pruned tokens, or the top token alone in
+ * a confident frame, see DecoderOptions::greedy_margin. Sets the beam width of the frame.
+ *
+ * @param prob, probabilities over the vocabulary of one time step
+ * @param log_prob_idx, tokens of the time step kept by the pruning, with their log probability
+ * @return the selected tokens, valid until the next frame
+ */
+const std::vector<std::pair<size_t, float>>&
+DecoderState::select_candidates(const std::vector<double>& prob,
+                                const std::vector<std::pair<size_t, float>>& log_prob_idx)
+{
+    const std::vector<std::pair<size_t, float>>* candidates = &log_prob_idx;
+    frame_beam_width = options->beam_width;
+    if (options->deadline_ms > 0.0) {
+        frame_beam_width = std::min(frame_beam_width, deadline_beam_width);
+    }
+    if (options->max_trie_nodes > 0) {
+        frame_beam_width = std::min(frame_beam_width, budget_beam_width);
+    }
+    if (options->greedy_margin > 0.0) {
+        size_t argmax;
+        if (get_argmax_margin(prob, options->log_probs_input, argmax) >= options->greedy_margin) {
+            // confident frame, only its top token is expanded. A confident word boundary
+            // collapses the beam to its best prefix, which is then decoded greedily until the
+            // next uncertain frame
+            const TokenAttributes& attributes = options->token_attributes[argmax];
+            if (attributes.is_space()
+                || (options->is_bpe_based && argmax != options->blank_id
+                    && !attributes.is_bpe_continuation())) {
+                greedy_span = true;
+            }
+            float log_prob = options->log_probs_input ? prob[argmax]
+                                                      : std::log(prob[argmax] + NUM_FLT_MIN);
+            scratch.greedy_log_prob_idx.assign(1, std::make_pair(argmax, log_prob));
+            candidates = &scratch.greedy_log_prob_idx;
+        } else {
+            greedy_span = false;
+        }
+        if (greedy_span) {
+            frame_beam_width = 1;
+        }
+    }
+    return *candidates;
+}
+
+/**
+ * @brief Updates the paths waiting for the language model with the scores of their n-grams,
+ * then keeps the best prefixes of the frame
+ */
+void DecoderState::end_frame()
+{
+    apply_lm_expansions();
+
+    prefixes.clear();
+    // update log probs
+    root.iterate_to_vec(prefixes, hotword_scorer != nullptr);
+
+    // only preserve top beam_size prefixes
+    keep_best_prefixes(frame_beam_width);
+    if (options->max_trie_nodes > 0) {
+        enforce_node_budget();
+    }
+
+    // the cutoff of the next frame starts from the worst prefix kept
+    worst_beam_score = NUM_FLT_INF;
+    best_prefix = prefixes[0];
+    for (PathTrie* prefix : prefixes) {
+        worst_beam_score = std::min(worst_beam_score, prefix->score_hw);
+        if (prefix_compare(prefix, best_prefix)) {
+            best_prefix = prefix;
+        }
+    }
+
+    ++abs_time_step;
+}
+
+void DecoderState::keep_best_prefixes(size_t beam_width)
+{
+    if (prefixes.size() >= beam_width) {
+        std::nth_element(
+            prefixes.begin(), prefixes.begin() + beam_width, prefixes.end(), prefix_compare);
+        for (size_t i = beam_width; i < prefixes.size(); ++i) {
+            prefixes[i]->remove();
+        }
+
+        prefixes.resize(beam_width);
+    }
+}
+
+/**
+ * @brief Keeps the trie within DecoderOptions::max_trie_nodes. Removing a prefix frees the
+ * nodes of its path that no other prefix shares, so the beam is halved until the trie fits or
+ * a single prefix is left, and the narrowed width applies to the next frames. The freed nodes
+ * are then deleted rather than kept for reuse. The beam widens back by doubling once the trie
+ * is under half the budget.
+ */
+void DecoderState::enforce_node_budget()
+{
+    size_t budget = options->max_trie_nodes;
+    if (node_pool.num_live_nodes() <= budget) {
+        if (budget_beam_width < options->beam_width && node_pool.num_live_nodes() <= budget / 2) {
+            budget_beam_width = std::min(options->beam_width, 2 * budget_beam_width);
+        }
+        return;
+    }
+
+    while (node_pool.num_live_nodes() > budget && prefixes.size() > 1) {
+        budget_beam_width = std::max<size_t>(1, std::min(budget_beam_width, prefixes.size()) / 2);
+        keep_best_prefixes(budget_beam_width);
+    }
+    node_pool.trim();
+}
+
+/**
+ * @brief Extends the prefixes with the tokens of one frame. The features are compile-time
+ * constants, so each configuration runs without the branches and the bookkeeping of the
+ * features it doesn't use, e.g. the hotword scores without hotwords.
+ *
+ * @param log_prob_idx, tokens of the time step kept by the pruning, with their log probability
+ * @param beam, blank and repeat updates of the frame, see gather_beam_scores()
+ * @param offset, first slot of the beam of the state in beam
+ */
+template <unsigned Features>
+void DecoderState::expand_frame(const std::vector<std::pair<size_t, float>>& log_prob_idx,
+                                const DecoderScratch::BeamScores& beam,
+                                size_t offset)
+{
+    constexpr bool has_scorer = (Features & FEATURE_SCORER) != 0;
+    constexpr bool has_hotwords = (Features & FEATURE_HOTWORDS) != 0;
+    constexpr bool is_bpe_based = (Features & FEATURE_BPE) != 0;
+    constexpr bool has_lexicon = (Features & FEATURE_LEXICON) != 0;
+    constexpr bool is_subword_lm = (Features & FEATURE_SUBWORD_LM) != 0;
+
+    // the blank and the repeated characters keep the prefixes as they are
+    scatter_beam_scores<Features>(beam, offset);
+
+    // loop over chars
+    for (size_t index = 0; index < log_prob_idx.size(); ++index) {
+        auto c = log_prob_idx[index].first;
+        auto log_prob_c = log_prob_idx[index].second;
+
+        // blank
+        if (c == options->blank_id) {
+            continue;
+        }
+
+        for (size_t i = 0; i < prefixes.size() && i < options->beam_width; ++i) {
 
-                // repeated character
-                if (c == prefix->character) {
-                    prefix->log_prob_nb_cur = log_sum_exp(prefix->log_prob_nb_cur,
-                                                          log_prob_c + prefix->log_prob_nb_prev);
+            auto prefix = prefixes[i];
 
-                    prefix->log_prob_nb_cur_hw = log_sum_exp(
-                        prefix->log_prob_nb_cur_hw, log_prob_c + prefix->log_prob_nb_prev_hw);
+            if constexpr (has_scorer) {
+                // the prefixes are in no particular order, the next ones may still pass
+                if (log_prob_c + prefix->score_hw < frame_min_cutoff) {
+                    continue;
                 }
+            }
 
-                // get new prefix
-                auto new_path = prefix->get_path_trie(
-                    c, abs_time_step, log_prob_c, true, !options->is_bpe_based);
+            // get new prefix
+            auto new_path
+                = prefix->get_path_trie(c, abs_time_step, log_prob_c, true, !is_bpe_based);
 
-                if (new_path != nullptr) {
+            if (new_path != nullptr) {
 
-                    float lm_score = 0.0;
-                    bool is_hotpath = false;
-                    bool reset_score = false;
+                float lm_score = 0.0;
+                bool is_hotpath = false;
+                bool reset_score = false;
 
-                    // check if the current node is a start of the word
-                    if ((ext_scorer != nullptr || hotword_scorer != nullptr)
-                        && is_start_of_word(new_path)) {
+                // check if the current node is a start of the word
+                if constexpr (has_scorer || has_hotwords) {
+                    if (is_start_of_word<Features>(new_path)) {
                         new_path->mark_as_word_start_char();
                     }
+                }
 
-                    // check if the current node is part of a hotword
-                    if (hotword_scorer != nullptr) {
-                        new_path->copy_parent_hotword_params();
-                        is_hotpath = hotword_scorer->is_hotpath(new_path, space_id, apostrophe_id);
+                // check if the current node is part of a hotword
+                if constexpr (has_hotwords) {
+                    new_path->copy_parent_hotword_params();
+                    is_hotpath = hotword_scorer->is_hotpath(new_path, space_id, apostrophe_id);
 
-                        if (!is_hotpath) {
-                            new_path->reset_hotword_params();
-                            if (prefix->is_hotpath()) {
-                                reset_score = true;
-                            }
+                    if (!is_hotpath) {
+                        new_path->reset_hotword_params();
+                        if (prefix->is_hotpath()) {
+                            reset_score = true;
                         }
                     }
+                }
 
-                    // hotword scoring
-                    if (is_hotpath) {
-                        new_path->mark_as_hotpath();
-
-                        // need to consider original score when previous word is a
-                        // partial hotword
-                        if (prefix->is_hotpath() && new_path->hotword_dictionary_state == 0) {
-                            reset_score = true;
-                        }
+                // hotword scoring
+                if (is_hotpath) {
+                    new_path->mark_as_hotpath();
 
-                        // update hotword related params of new node and calculate hotword score
-                        hotword_scorer->estimate_hw_score(new_path);
+                    // need to consider original score when previous word is a
+                    // partial hotword
+                    if (prefix->is_hotpath() && new_path->hotword_dictionary_state == 0) {
+                        reset_score = true;
                     }
-                    // unknown scoring
-                    else {
-                        // check if the current node forms OOV word and add unk score
-                        if (options->is_bpe_based && ext_scorer != nullptr
-                            && ext_scorer->has_lexicon()) {
-                            bool is_oov = new_path->is_oov_token();
-                            if (is_oov) {
-                                lm_score += options->unk_score;
-                            }
-                        }
+
+                    // update hotword related params of new node and calculate hotword score
+                    hotword_scorer->estimate_hw_score(new_path);
+                }
+                // unknown scoring
+                else if constexpr (is_bpe_based && has_lexicon) {
+                    // check if the current node forms OOV word and add unk score
+                    bool is_oov = new_path->is_oov_token();
+                    if (is_oov) {
+                        lm_score += options->unk_score;
                     }
+                }
 
-                    // language model scoring
-                    if (ext_scorer != nullptr
-                        && (c == space_id || ext_scorer->is_character_based()
-                            || ext_scorer->is_bpe_based())) {
+                // language model lookahead: a partial word scores as its best completion, the
+                // difference is carried along the word and replaced by its real score once the
+                // word is complete
+                if constexpr (has_lexicon && !is_bpe_based && !is_subword_lm) {
+                    if (lm_lookahead) {
+                        lm_score += ext_scorer->alpha
+                                    * (ext_scorer->get_lookahead(new_path->lexicon_state())
+                                       - ext_scorer->get_lookahead(prefix->lexicon_state()));
+                    }
+                }
 
-                        PathTrie* prefix_to_score = nullptr;
+                // language model scoring is deferred to score all the frame's n-grams
+                // in a single batch
+                if constexpr (has_scorer) {
+                    if (is_subword_lm || c == space_id) {
                         // skip scoring the space
-                        if (ext_scorer->is_character_based() || ext_scorer->is_bpe_based()) {
-                            prefix_to_score = new_path;
-                        } else {
-                            prefix_to_score = prefix;
-                        }
-                        std::vector<std::string> ngram;
-                        ngram = ext_scorer->make_ngram(prefix_to_score);
-                        lm_score += ext_scorer->get_log_cond_prob(ngram) * ext_scorer->alpha;
-                        lm_score += ext_scorer->beta;
+                        PathTrie* prefix_to_score = is_subword_lm ? new_path : prefix;
+                        size_t query_id = add_lm_query(prefix_to_score);
+                        lm_expansions.push_back(
+                            { new_path, log_prob_c, lm_score, reset_score, query_id });
+                        continue;
                     }
-
-                    // update original and hotword score for the new path
-                    update_score(new_path, log_prob_c, lm_score, reset_score);
                 }
 
-            } // end of loop over prefix
-        }     // end of loop over vocabulary
-
-        prefixes.clear();
-        // update log probs
-        root.iterate_to_vec(prefixes);
-
-        // only preserve top beam_size prefixes
-        if (prefixes.size() >= options->beam_width) {
-            std::nth_element(prefixes.begin(),
-                             prefixes.begin() + options->beam_width,
-                             prefixes.end(),
-                             prefix_compare);
-            for (size_t i = options->beam_width; i < prefixes.size(); ++i) {
-                prefixes[i]->remove();
+                // update original and hotword score for the new path
+                update_score<Features>(new_path, log_prob_c, lm_score, reset_score);
             }
 
-            prefixes.resize(options->beam_width);
+        } // end of loop over prefix
+    }     // end of loop over vocabulary
+}
+
+/**
+ * @brief Copies the scores of the beam to the slots of beam from offset, with the log
+ * probabilities of the blank and of the last token of each prefix in the frame, for
+ * update_blanks_and_repeats(). Sets the cutoff of the frame.
+ *
+ * @param prob, probabilities over the vocabulary of one time step
+ * @param log_prob_idx, tokens of the time step kept by the pruning, with their log probability
+ * @param beam, slots of the updates, resized to hold the beam from offset
+ * @param offset, first slot of the beam of the state in beam
+ */
+void DecoderState::gather_beam_scores(const std::vector<double>& prob,
+                                      const std::vector<std::pair<size_t, float>>& log_prob_idx,
+                                      DecoderScratch::BeamScores& beam,
+                                      size_t offset)
+{
+    size_t num_prefixes = num_beam_slots();
+    frame_min_cutoff = -NUM_FLT_INF;
+    if (ext_scorer != nullptr && num_prefixes == options->beam_width) {
+        float blank_prob = options->log_probs_input ? prob[options->blank_id]
+                                                    : std::log(prob[options->blank_id]);
+        frame_min_cutoff = worst_beam_score + blank_prob - std::max(0.0, ext_scorer->beta);
+    }
+
+    // log probabilities of the tokens of the frame, shifted by one so that the root, which has
+    // no token, reads the first slot which is never set
+    std::vector<float>& frame_log_probs = scratch.frame_log_probs;
+    frame_log_probs.resize(options->vocab.size() + 1, -NUM_FLT_INF);
+    float log_prob_blank = -NUM_FLT_INF;
+    for (const auto& token : log_prob_idx) {
+        frame_log_probs[token.first + 1] = token.second;
+        if (token.first == options->blank_id) {
+            log_prob_blank = token.second;
         }
+    }
 
-    } // end of loop over time
+    for (size_t i = 0; i < num_prefixes; ++i) {
+        const PathTrie* prefix = prefixes[i];
+        beam.score[offset + i] = prefix->score;
+        beam.score_hw[offset + i] = prefix->score_hw;
+        beam.log_prob_nb_prev[offset + i] = prefix->log_prob_nb_prev;
+        beam.log_prob_nb_prev_hw[offset + i] = prefix->log_prob_nb_prev_hw;
+        beam.log_prob_blank[offset + i] = log_prob_blank;
+        beam.log_prob_repeat[offset + i] = frame_log_probs[prefix->character + 1];
+        beam.min_cutoff[offset + i] = frame_min_cutoff;
+    }
+
+    for (const auto& token : log_prob_idx) {
+        frame_log_probs[token.first + 1] = -NUM_FLT_INF;
+    }
+}
+
+/**
+ * @brief Updates the prefixes staying the same in the frame: all of them with the blank, and
+ * those ending without a blank with their last token repeated. The updates run over the beam
+ * slots in straight loops which the compiler vectorizes, whether the slots hold one beam or
+ * the beams of a whole batch. The updates of a frame only read the scores of the previous
+ * frame, so they don't depend on the expansions made after.
+ *
+ * @param beam, scores gathered by gather_beam_scores()
+ * @param num_slots, number of slots of beam
+ */
+template <bool HasHotwords>
+void DecoderState::update_blanks_and_repeats(DecoderScratch::BeamScores& beam, size_t num_slots)
+{
+    // the current probabilities of the prefixes are not set yet in the frame, so the updates
+    // are the first terms of their sums
+    const float* score = beam.score.data();
+    const float* score_hw = beam.score_hw.data();
+    const float* log_prob_nb_prev = beam.log_prob_nb_prev.data();
+    const float* log_prob_nb_prev_hw = beam.log_prob_nb_prev_hw.data();
+    const float* log_prob_blank = beam.log_prob_blank.data();
+    const float* log_prob_repeat = beam.log_prob_repeat.data();
+    const float* min_cutoff = beam.min_cutoff.data();
+    float* log_prob_b_cur = beam.log_prob_b_cur.data();
+    float* log_prob_b_cur_hw = beam.log_prob_b_cur_hw.data();
+    float* log_prob_nb_cur = beam.log_prob_nb_cur.data();
+    float* log_prob_nb_cur_hw = beam.log_prob_nb_cur_hw.data();
+    for (size_t i = 0; i < num_slots; ++i) {
+        bool blank = log_prob_blank[i] > -NUM_FLT_INF
+                     && log_prob_blank[i] + score_hw[i] >= min_cutoff[i];
+        log_prob_b_cur[i] = blank ? log_prob_blank[i] + score[i] : -NUM_FLT_INF;
+        if constexpr (HasHotwords) {
+            log_prob_b_cur_hw[i] = blank ? log_prob_blank[i] + score_hw[i] : -NUM_FLT_INF;
+        }
+    }
+    for (size_t i = 0; i < num_slots; ++i) {
+        bool repeat = log_prob_repeat[i] > -NUM_FLT_INF
+                      && log_prob_repeat[i] + score_hw[i] >= min_cutoff[i];
+        log_prob_nb_cur[i] = repeat ? log_prob_repeat[i] + log_prob_nb_prev[i] : -NUM_FLT_INF;
+        if constexpr (HasHotwords) {
+            log_prob_nb_cur_hw[i]
+                = repeat ? log_prob_repeat[i] + log_prob_nb_prev_hw[i] : -NUM_FLT_INF;
+        }
+    }
+}
+
+/**
+ * @brief Copies the blank and repeat updates of the beam back to its prefixes
+ *
+ * @param beam, updates of update_blanks_and_repeats()
+ * @param offset, first slot of the beam of the state in beam
+ */
+template <unsigned Features>
+void DecoderState::scatter_beam_scores(const DecoderScratch::BeamScores& beam, size_t offset)
+{
+    constexpr bool has_hotwords = (Features & FEATURE_HOTWORDS) != 0;
+    size_t num_prefixes = num_beam_slots();
+    for (size_t i = 0; i < num_prefixes; ++i) {
+        PathTrie* prefix = prefixes[i];
+        prefix->log_prob_b_cur = beam.log_prob_b_cur[offset + i];
+        prefix->log_prob_nb_cur = beam.log_prob_nb_cur[offset + i];
+        if constexpr (has_hotwords) {
+            prefix->log_prob_b_cur_hw = beam.log_prob_b_cur_hw[offset + i];
+            prefix->log_prob_nb_cur_hw = beam.log_prob_nb_cur_hw[offset + i];
+        }
+    }
+}
+
+/**
+ * @brief Queues the n-gram ending at the given node for scoring by the language model. The
+ * same n-gram is only queued once per frame.
+ *
+ * @param prefix_to_score, PathTrie node ending the n-gram
+ * @return index of the n-gram in the queue
+ */
+size_t DecoderState::add_lm_query(PathTrie* prefix_to_score)
+{
+    std::vector<std::string>& ngram = scratch.ngram;
+    ext_scorer->make_ngram(prefix_to_score, ngram, scratch.prefix_vec, scratch.prefix_steps);
+    return lm_queries.insert(ngram);
+}
+
+/**
+ * @brief Scores the n-grams queued during the frame in one batch
+ */
+void DecoderState::score_lm_queries()
+{
+    if (!lm_queries.empty()) {
+        ext_scorer->get_log_cond_probs(lm_queries, lm_query_scores, scratch.lm_batch);
+    }
+}
+
+/**
+ * @brief Updates the scores of the paths waiting for the language model, once the n-grams of
+ * the frame are scored
+ */
+void DecoderState::apply_lm_expansions()
+{
+    for (const auto& expansion : lm_expansions) {
+        float lm_score = expansion.lm_score;
+        lm_score += lm_query_scores[expansion.query_id] * ext_scorer->alpha;
+        lm_score += ext_scorer->beta;
+        // only the hotwords change how the scores are updated
+        if (hotword_scorer != nullptr) {
+            update_score<FEATURE_HOTWORDS>(
+                expansion.path, expansion.log_prob_c, lm_score, expansion.reset_score);
+        } else {
+            update_score<0>(expansion.path, expansion.log_prob_c, lm_score, expansion.reset_score);
+        }
+    }
+
+    lm_expansions.clear();
+    lm_queries.clear();
 }
 
 std::vector<std::pair<double, Output>> DecoderState::decode()
 {
-    std::vector<PathTrie*> prefixes_copy = prefixes;
-    std::unordered_map<const PathTrie*, float> scores;
+    std::vector<PathTrie*>& prefixes_copy = scratch.prefixes;
+    std::unordered_map<const PathTrie*, float>& scores = scratch.scores;
+    prefixes_copy.assign(prefixes.begin(), prefixes.end());
+    scores.clear();
     for (PathTrie* prefix : prefixes_copy) {
         scores[prefix] = prefix->score_hw;
     }
@@ -315,19 +991,20 @@ std::vector<std::pair<double, Output>> DecoderState::decode()
             auto prefix = prefixes_copy[i];
             if (!prefix->is_empty() && prefix->character != space_id) {
                 float score = 0.0;
-                std::vector<std::string> ngram = ext_scorer->make_ngram(prefix);
-                score = ext_scorer->get_log_cond_prob(ngram) * ext_scorer->alpha;
+                ext_scorer->make_ngram(
+                    prefix, scratch.ngram, scratch.prefix_vec, scratch.prefix_steps);
+                score = ext_scorer->get_log_cond_prob(scratch.ngram) * ext_scorer->alpha;
                 score += ext_scorer->beta;
+                if (lm_lookahead) {
+                    // the real score of the last word replaces its lookahead
+                    score -= ext_scorer->get_lookahead(prefix->lexicon_state()) * ext_scorer->alpha;
+                }
                 scores[prefix] += score;
             }
         }
     }
 
-    using namespace std::placeholders;
-    size_t num_prefixes = std::min(prefixes_copy.size(), options->beam_width);
-    std::sort(prefixes_copy.begin(),
-              prefixes_copy.begin() + num_prefixes,
-              std::bind(prefix_compare_external_scores, _1, _2, scores));
+    // the prefixes are ranked once, by get_beam_search_result()
 
     // compute aproximate ctc score as the return score, without affecting the
     // return order of decoding result. To delete when decoder gets stable.
@@ -348,7 +1025,124 @@ std::vector<std::pair<double, Output>> DecoderState::decode()
         prefixes_copy[i]->approx_ctc = approx_ctc;
     }
 
-    return get_beam_search_result(prefixes_copy, options->beam_width);
+    auto results = get_beam_search_result(prefixes_copy, options->beam_width);
+    for (auto& result : results) {
+        result.second.degraded = degraded;
+        if (!committed.tokens.empty()) {
+            Output& output = result.second;
+            output.tokens.insert(
+                output.tokens.begin(), committed.tokens.begin(), committed.tokens.end());
+            output.timesteps.insert(
+                output.timesteps.begin(), committed.timesteps.begin(), committed.timesteps.end());
+        }
+    }
+    return results;
+}
+
+std::pair<double, Output> DecoderState::best_partial() const
+{
+    std::pair<double, Output> best(best_prefix->score_hw, committed);
+    Output& output = best.second;
+    output.degraded = degraded;
+    std::vector<int> tokens;
+    std::vector<int> timesteps;
+    best_prefix->get_path_vec(tokens, timesteps);
+    output.tokens.insert(output.tokens.end(), tokens.begin(), tokens.end());
+    output.timesteps.insert(output.timesteps.end(), timesteps.begin(), timesteps.end());
+    return best;
+}
+
+Output DecoderState::take_committed()
+{
+    Output taken;
+    std::swap(taken, committed);
+    return taken;
+}
+
+/**
+ * @brief Commits the longest common prefix of the beam. Its tokens can't change anymore, so
+ * they move to the committed output and their nodes are freed, except for the tail of the
+ * prefix that the language model reads as the context of the next words: the max_order
+ * previous tokens of a character or bpe language model, or the nodes up to the max_order-th
+ * space of a word language model. The tail becomes the first child of the root.
+ */
+void DecoderState::commit_common_prefix()
+{
+    PathTrie* first_kept = root.get_common_ancestor();
+    if (ext_scorer != nullptr) {
+        size_t max_order = ext_scorer->get_max_order();
+        if (ext_scorer->is_character_based() || ext_scorer->is_bpe_based()) {
+            for (size_t i = 0; i < max_order && first_kept != &root; ++i) {
+                first_kept = first_kept->parent;
+            }
+        } else {
+            // the word of the context before the last space needs the space, so that the
+            // language model doesn't take it as the start of the sentence
+            size_t num_spaces = 0;
+            while (first_kept != &root && num_spaces < max_order) {
+                first_kept = first_kept->parent;
+                num_spaces += first_kept->character == space_id;
+            }
+        }
+    }
+    if (first_kept == &root || first_kept->parent == &root) {
+        return;
+    }
+    root.reroot(first_kept, committed.tokens, committed.timesteps);
+}
+
+/**
+ * @brief Seeds the trie with the tail of a previous result, which the language model queries of
+ * the next frames read as their context. The tail is chosen like the context kept by
+ * commit_common_prefix(), but starts after a space for a word based model, so that the lexicon
+ * state is at the start of a word. The path of the tail becomes the single prefix, with the
+ * probability of the root.
+ *
+ * @param context, previous result
+ */
+void DecoderState::seed_context(const Output& context)
+{
+    if (ext_scorer == nullptr || context.tokens.empty()) {
+        return;
+    }
+    const std::vector<int>& tokens = context.tokens;
+    size_t max_order = ext_scorer->get_max_order();
+    size_t begin = tokens.size();
+    if (ext_scorer->is_character_based() || ext_scorer->is_bpe_based()) {
+        begin -= std::min(begin, max_order);
+    } else {
+        size_t num_spaces = 0;
+        while (begin > 0 && num_spaces < max_order) {
+            --begin;
+            num_spaces += tokens[begin] == space_id;
+        }
+        begin += begin > 0 || tokens[0] == space_id;
+    }
+
+    PathTrie* path = &root;
+    for (size_t i = begin; i < tokens.size(); ++i) {
+        PathTrie* child = path->get_path_trie(tokens[i], -1, 0.0, true, !options->is_bpe_based);
+        // a tail the lexicon doesn't spell keeps the context seeded so far
+        if (child == nullptr) {
+            break;
+        }
+        if (path != &root) {
+            // an inner node of the tail isn't a prefix
+            path->remove();
+        }
+        path = child;
+    }
+    if (path == &root) {
+        return;
+    }
+
+    root.remove();
+    path->log_prob_b_prev = path->log_prob_b_prev_hw = 0.0;
+    path->log_prob_nb_prev = path->log_prob_nb_prev_hw = -NUM_FLT_INF;
+    path->score = path->score_hw = 0.0;
+    prefixes.assign(1, path);
+    worst_beam_score = path->score_hw;
+    best_prefix = path;
 }
 
 std::vector<std::pair<double, Output>>
@@ -362,6 +1156,36 @@ ctc_beam_search_decoder(const std::vector<std::vector<double>>& probs_seq,
     return state.decode();
 }
 
+void ctc_beam_search_warmup(DecoderOptions* options,
+                            Scorer* ext_scorer,
+                            HotwordScorer* hotword_scorer,
+                            size_t num_time_steps)
+{
+    if (ext_scorer != nullptr) {
+        ext_scorer->warmup();
+    }
+
+    // spread most of the probability over a few random labels per time step, so the search
+    // goes through the lexicon and the language model like a real decode does
+    size_t vocab_size = options->vocab.size();
+    std::mt19937 generator(0);
+    std::uniform_int_distribution<size_t> label_distribution(0, vocab_size - 1);
+    std::vector<std::vector<double>> probs_seq(num_time_steps,
+                                               std::vector<double>(vocab_size, 0.1 / vocab_size));
+    for (auto& probs : probs_seq) {
+        for (int i = 0; i < 3; ++i) {
+            probs[label_distribution(generator)] += 0.3;
+        }
+        if (options->log_probs_input) {
+            for (auto& prob : probs) {
+                prob = std::log(prob);
+            }
+        }
+    }
+
+    ctc_beam_search_decoder(probs_seq, options, ext_scorer, hotword_scorer);
+}
+
 std::vector<std::pair<double, Output>>
 ctc_beam_search_decoder_with_given_state(const std::vector<std::vector<double>>& probs_seq,
                                          DecoderState* state,
@@ -375,6 +1199,286 @@ ctc_beam_search_decoder_with_given_state(const std::vector<std::vector<double>>&
     }
 }
 
+/**
+ * @brief Waits for the tasks of all the futures, without taking their results. A batch waits
+ * for all its tasks before it takes their results, which rethrows the exception of a failed
+ * task, so that no task still runs with the locals of the batch once it unwinds.
+ *
+ * @param futures, futures of the tasks of a batch
+ */
+template <typename T>
+static void wait_for_all(const std::vector<std::future<T>>& futures)
+{
+    for (const auto& future : futures) {
+        if (future.valid()) {
+            future.wait();
+        }
+    }
+}
+
+/**
+ * @brief Decodes one segment of a long sequence with the frames of its context before it, and
+ * keeps its best result without the tokens of the context, at the timesteps of the sequence
+ *
+ * @param probs_seq, probabilities over the vocabulary of each time step of the sequence
+ * @param context_begin, first frame of the context of the segment
+ * @param begin, first frame of the segment
+ * @param end, frame past the end of the segment
+ * @param previous, result of the previous segments whose language model context the segment
+ *                  starts from, see DecoderState::seed_context(), or nullptr
+ * @return best result of the segment, empty when the segment has no result
+ */
+static std::pair<double, Output> decode_segment(const std::vector<std::vector<double>>& probs_seq,
+                                                size_t context_begin,
+                                                size_t begin,
+                                                size_t end,
+                                                const Output* previous,
+                                                DecoderOptions* options,
+                                                Scorer* ext_scorer,
+                                                HotwordScorer* hotword_scorer)
+{
+    std::vector<std::vector<double>> segment(probs_seq.begin() + context_begin,
+                                             probs_seq.begin() + end);
+    DecoderState state(options, ext_scorer, hotword_scorer);
+    if (previous != nullptr) {
+        state.seed_context(*previous);
+    }
+    state.next(segment);
+    auto results = state.decode();
+
+    std::pair<double, Output> best(0.0, Output());
+    if (results.empty()) {
+        return best;
+    }
+    best.first = results[0].first;
+    const Output& output = results[0].second;
+    best.second.degraded = output.degraded;
+    // the seeded tokens are at timestep -1
+    int context_length = static_cast<int>(begin - context_begin);
+    for (size_t i = 0; i < output.tokens.size(); ++i) {
+        if (output.timesteps[i] >= context_length) {
+            best.second.tokens.push_back(output.tokens[i]);
+            best.second.timesteps.push_back(output.timesteps[i] + static_cast<int>(context_begin));
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Decodes the segments of a sequence one after the other, each starting from the
+ * language model context of the best results of the previous ones
+ *
+ * @param probs_seq, probabilities over the vocabulary of each time step of the sequence
+ * @param segments, first frame and frame past the end of each segment
+ * @return best result of each segment
+ */
+static std::vector<std::pair<double, Output>>
+decode_segments_in_order(const std::vector<std::vector<double>>& probs_seq,
+                         const std::vector<std::pair<size_t, size_t>>& segments,
+                         DecoderOptions* options,
+                         Scorer* ext_scorer,
+                         HotwordScorer* hotword_scorer)
+{
+    std::vector<std::pair<double, Output>> results;
+    // tokens of the segments decoded so far, a segment without result keeps the context
+    Output context;
+    for (const auto& segment : segments) {
+        results.push_back(decode_segment(probs_seq,
+                                         segment.first,
+                                         segment.first,
+                                         segment.second,
+                                         &context,
+                                         options,
+                                         ext_scorer,
+                                         hotword_scorer));
+        const Output& output = results.back().second;
+        context.tokens.insert(context.tokens.end(), output.tokens.begin(), output.tokens.end());
+    }
+    return results;
+}
+
+/**
+ * @brief Decodes a batch in long form: the sequences are cut at their pauses, and the best
+ * results of the segments of a sequence are stitched into its single result. The score of a
+ * stitched result is the sum of the scores of its segments. All the segments of the batch are
+ * decoded in parallel on the pool, or only the sequences with segment_carry_context, whose
+ * segments are decoded in order. A sequence without pause is decoded whole, with all its
+ * results.
+ */
+static std::vector<std::vector<std::pair<double, Output>>>
+ctc_beam_search_decoder_long_form(const std::vector<std::vector<std::vector<double>>>& probs_split,
+                                  DecoderOptions* options,
+                                  Scorer* ext_scorer,
+                                  HotwordScorer* hotword_scorer,
+                                  ThreadPool& pool)
+{
+    VALID_CHECK(!(options->segment_carry_context && options->segment_context_frames > 0),
+                "The context frames and the carried context of the segments are exclusive");
+    size_t batch_size = probs_split.size();
+    std::vector<std::vector<std::pair<size_t, size_t>>> segments(batch_size);
+    std::vector<std::future<std::vector<std::pair<double, Output>>>> whole_res(batch_size);
+    std::vector<std::vector<std::future<std::pair<double, Output>>>> segment_res(batch_size);
+    std::vector<std::future<std::vector<std::pair<double, Output>>>> ordered_res(batch_size);
+
+    // enqueue the tasks of decoding, one per segment
+    for (size_t i = 0; i < batch_size; ++i) {
+        segments[i] = get_blank_segments(probs_split[i],
+                                         options->blank_id,
+                                         options->log_probs_input,
+                                         options->segment_blank_prob,
+                                         options->segment_min_pause);
+        if (segments[i].size() == 1) {
+            whole_res[i] = pool.enqueue(ctc_beam_search_decoder,
+                                        std::cref(probs_split[i]),
+                                        options,
+                                        ext_scorer,
+                                        hotword_scorer);
+            continue;
+        }
+        if (options->segment_carry_context) {
+            ordered_res[i] = pool.enqueue(decode_segments_in_order,
+                                          std::cref(probs_split[i]),
+                                          std::cref(segments[i]),
+                                          options,
+                                          ext_scorer,
+                                          hotword_scorer);
+            continue;
+        }
+        for (const auto& segment : segments[i]) {
+            size_t context_begin = segment.first
+                                   - std::min(segment.first, options->segment_context_frames);
+            segment_res[i].emplace_back(pool.enqueue(decode_segment,
+                                                     std::cref(probs_split[i]),
+                                                     context_begin,
+                                                     segment.first,
+                                                     segment.second,
+                                                     nullptr,
+                                                     options,
+                                                     ext_scorer,
+                                                     hotword_scorer));
+        }
+    }
+
+    // the pool belongs to the caller, so all the tasks are done before the segments can go out
+    // of scope
+    wait_for_all(whole_res);
+    wait_for_all(ordered_res);
+    for (const auto& res : segment_res) {
+        wait_for_all(res);
+    }
+
+    // stitch the results of the segments
+    std::vector<std::vector<std::pair<double, Output>>> batch_results(batch_size);
+    for (size_t i = 0; i < batch_size; ++i) {
+        if (whole_res[i].valid()) {
+            batch_results[i] = whole_res[i].get();
+            continue;
+        }
+        std::vector<std::pair<double, Output>> segment_results;
+        if (ordered_res[i].valid()) {
+            segment_results = ordered_res[i].get();
+        } else {
+            for (auto& res : segment_res[i]) {
+                segment_results.push_back(res.get());
+            }
+        }
+        std::pair<double, Output> stitched(0.0, Output());
+        for (const auto& segment : segment_results) {
+            stitched.first += segment.first;
+            stitched.second.degraded = stitched.second.degraded || segment.second.degraded;
+            stitched.second.tokens.insert(stitched.second.tokens.end(),
+                                          segment.second.tokens.begin(),
+                                          segment.second.tokens.end());
+            stitched.second.timesteps.insert(stitched.second.timesteps.end(),
+                                             segment.second.timesteps.begin(),
+                                             segment.second.timesteps.end());
+        }
+        batch_results[i].push_back(std::move(stitched));
+    }
+    return batch_results;
+}
+
+/**
+ * @brief Decodes a batch in lockstep: the batch is split into one share per worker, and each
+ * worker advances all the utterances of its share one frame at a time with
+ * DecoderState::next_lockstep(), which scores their language model queries together.
+ */
+static std::vector<std::vector<std::pair<double, Output>>>
+ctc_beam_search_decoder_lockstep(const std::vector<std::vector<std::vector<double>>>& probs_split,
+                                 DecoderOptions* options,
+                                 Scorer* ext_scorer,
+                                 HotwordScorer* hotword_scorer,
+                                 ThreadPool& pool)
+{
+    size_t batch_size = probs_split.size();
+    size_t num_shares = std::min(options->num_processes, batch_size);
+    std::vector<std::vector<std::pair<double, Output>>> batch_results(batch_size);
+
+    auto decode_share = [&](size_t share) {
+        std::vector<std::unique_ptr<DecoderState>> states;
+        std::vector<DecoderState*> share_states;
+        std::vector<const std::vector<std::vector<double>>*> share_probs;
+        for (size_t i = share; i < batch_size; i += num_shares) {
+            states.emplace_back(new DecoderState(options, ext_scorer, hotword_scorer));
+            share_states.push_back(states.back().get());
+            share_probs.push_back(&probs_split[i]);
+        }
+        DecoderState::next_lockstep(share_states, share_probs);
+        for (size_t i = share, k = 0; i < batch_size; i += num_shares, ++k) {
+            batch_results[i] = states[k]->decode();
+        }
+    };
+
+    // enqueue the tasks of decoding, one per share
+    std::vector<std::future<void>> res;
+    for (size_t share = 0; share < num_shares; ++share) {
+        res.emplace_back(pool.enqueue(decode_share, share));
+    }
+    // the pool belongs to the caller, so all the shares are done before the batch can unwind
+    wait_for_all(res);
+    for (auto& share_res : res) {
+        share_res.get();
+    }
+    return batch_results;
+}
+
+/**
+ * @brief Decodes a batch as low priority work on the shared workers of the streaming decoder,
+ * see DecoderOptions::offline_priority
+ *
+ * @param probs_split, probabilities over the vocabulary of each time step of each utterance
+ * @return results of each utterance
+ */
+static std::vector<std::vector<std::pair<double, Output>>>
+ctc_beam_search_decoder_offline(const std::vector<std::vector<std::vector<double>>>& probs_split,
+                                DecoderOptions* options,
+                                Scorer* ext_scorer,
+                                HotwordScorer* hotword_scorer)
+{
+    StreamWorkerPool& pool
+        = StreamWorkerPool::shared(options->num_processes, options->worker_pinning);
+    size_t batch_size = probs_split.size();
+
+    std::vector<std::vector<std::pair<double, Output>>> batch_results(batch_size);
+    std::vector<std::future<void>> res;
+    for (size_t i = 0; i < batch_size; ++i) {
+        res.emplace_back(pool.submit(
+            pool.assign_home(),
+            [&, i]() {
+                batch_results[i]
+                    = ctc_beam_search_decoder(probs_split[i], options, ext_scorer, hotword_scorer);
+            },
+            TaskPriority::LOW));
+    }
+
+    // the shared workers outlive the batch, so all its tasks are done before it can unwind
+    wait_for_all(res);
+    for (auto& r : res) {
+        r.get();
+    }
+    return batch_results;
+}
+
 std::vector<std::vector<std::pair<double, Output>>>
 ctc_beam_search_decoder_batch(const std::vector<std::vector<std::vector<double>>>& probs_split,
                               DecoderOptions* options,
@@ -382,8 +1486,25 @@ ctc_beam_search_decoder_batch(const std::vector<std::vector<std::vector<double>>
                               HotwordScorer* hotword_scorer)
 {
     VALID_CHECK_GT(options->num_processes, 0, "num_processes must be nonnegative!");
+    // the engines of the batch exclude each other
+    VALID_CHECK(!options->offline_priority
+                    || (options->segment_min_pause == 0 && !options->lockstep_batch),
+                "offline_priority can't be combined with segment_min_pause or lockstep_batch");
+    VALID_CHECK(options->segment_min_pause == 0 || !options->lockstep_batch,
+                "lockstep_batch can't be combined with segment_min_pause");
+    if (options->offline_priority) {
+        return ctc_beam_search_decoder_offline(probs_split, options, ext_scorer, hotword_scorer);
+    }
     // thread pool
     ThreadPool pool(options->num_processes);
+    if (options->segment_min_pause > 0) {
+        return ctc_beam_search_decoder_long_form(
+            probs_split, options, ext_scorer, hotword_scorer, pool);
+    }
+    if (options->lockstep_batch) {
+        return ctc_beam_search_decoder_lockstep(
+            probs_split, options, ext_scorer, hotword_scorer, pool);
+    }
     // number of samples
     size_t batch_size = probs_split.size();
 
@@ -413,24 +1534,46 @@ std::vector<std::vector<std::pair<double, Output>>> ctc_beam_search_decoder_batc
 
 {
     VALID_CHECK_GT(num_processes, 0, "num_processes must be nonnegative!");
-    // thread pool
-    ThreadPool pool(num_processes);
     // number of samples
     size_t batch_size = probs_split.size();
+    if (batch_size == 0) {
+        return {};
+    }
+    // the workers of the batch are placed once for all its streams, which must agree on it
+    const DecoderOptions* options = static_cast<DecoderState*>(states[0])->get_options();
+    for (size_t i = 1; i < batch_size; ++i) {
+        const DecoderOptions* state_options = static_cast<DecoderState*>(states[i])->get_options();
+        VALID_CHECK(state_options->worker_pinning == options->worker_pinning
+                        && state_options->replicate_lexicon == options->replicate_lexicon,
+                    "The streams of a batch must have the same worker_pinning and "
+                    "replicate_lexicon");
+    }
+    bool replicate_lexicon
+        = options->replicate_lexicon && options->worker_pinning != WorkerPinning::NONE;
+    // the workers persist across the chunks, and each stream is decoded by its home worker
+    StreamWorkerPool& pool = StreamWorkerPool::shared(num_processes, options->worker_pinning);
 
     // enqueue the tasks of decoding
-    std::vector<std::future<std::vector<std::pair<double, Output>>>> res;
+    std::vector<std::vector<std::pair<double, Output>>> batch_results(batch_size);
+    std::vector<std::future<void>> res;
     for (size_t i = 0; i < batch_size; ++i) {
-        res.emplace_back(pool.enqueue(ctc_beam_search_decoder_with_given_state,
-                                      std::cref(probs_split[i]),
-                                      static_cast<DecoderState*>(states[i]),
-                                      is_eos_s[i]));
+        auto state = static_cast<DecoderState*>(states[i]);
+        if (state->home_worker >= pool.size()) {
+            state->home_worker = pool.assign_home();
+        }
+        res.emplace_back(pool.submit(state->home_worker, [&, i, state]() {
+            if (replicate_lexicon) {
+                state->use_lexicon_replica(pool.node_of(state->home_worker));
+            }
+            batch_results[i]
+                = ctc_beam_search_decoder_with_given_state(probs_split[i], state, is_eos_s[i]);
+        }));
     }
 
-    // get decoding results
-    std::vector<std::vector<std::pair<double, Output>>> batch_results;
-    for (size_t i = 0; i < batch_size; ++i) {
-        batch_results.emplace_back(res[i].get());
+    // wait for the decoding results
+    wait_for_all(res);
+    for (auto& r : res) {
+        r.get();
     }
     return batch_results;
 }
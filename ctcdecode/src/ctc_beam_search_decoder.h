@@ -1,6 +1,12 @@
 #ifndef CTC_BEAM_SEARCH_DECODER_H_
 #define CTC_BEAM_SEARCH_DECODER_H_
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -9,6 +15,8 @@
 #include "output.h"
 #include "scorer.h"
 
+class ThreadPool;
+
 /* CTC Beam Search Decoder
 
  * Parameters:
@@ -46,7 +54,12 @@ ctc_beam_search_decoder(const std::vector<std::vector<double>>& probs_seq,
  *                     words. Default null, decoding the input sample without hotword scorer
  * Return:
  *     A 2-D vector that each element is a vector of beam search decoding
- *     result for one audio sample.
+ *     result for one audio sample. In long form (see DecoderOptions::segment_min_pause), a
+ *     sample cut into several segments has a single result, stitched from the best result of
+ *     each segment.
+ *
+ * With DecoderOptions::offline_priority, the batch runs as low priority work on the workers of
+ * ctc_beam_search_decoder_batch_with_states(), behind their streaming chunks.
 */
 std::vector<std::vector<std::pair<double, Output>>>
 ctc_beam_search_decoder_batch(const std::vector<std::vector<std::vector<double>>>& probs_split,
@@ -54,6 +67,89 @@ ctc_beam_search_decoder_batch(const std::vector<std::vector<std::vector<double>>
                               Scorer* ext_scorer = nullptr,
                               HotwordScorer* hotword_scorer = nullptr);
 
+/* Warm up the decoder before it serves the first request
+
+ * Pre-faults the memory of the scorer and runs a synthetic decode, so that the first real
+ * requests don't pay for page faults and cold caches.
+ *
+ * Parameters:
+ *     DecoderOptions, ext_scorer, hotword_scorer: Same as for ctc_beam_search_decoder().
+ *     num_time_steps: Number of synthetic time steps to decode.
+*/
+void ctc_beam_search_warmup(DecoderOptions* options,
+                            Scorer* ext_scorer = nullptr,
+                            HotwordScorer* hotword_scorer = nullptr,
+                            size_t num_time_steps = 100);
+
+/* Buffers reused by a DecoderState across frames and decodes. They keep their capacity, so that
+ * a decoder in the steady state doesn't allocate them again for every frame.
+ */
+struct DecoderScratch {
+    // pruned tokens of the frame, and the sort space of the pruning
+    std::vector<std::pair<int, double>> prob_idx;
+    std::vector<std::pair<size_t, float>> log_prob_idx;
+    // top token of a confident frame, decoded greedily
+    std::vector<std::pair<size_t, float>> greedy_log_prob_idx;
+
+    // n-gram of a prefix, and the path space of its words
+    std::vector<std::string> ngram;
+    std::vector<int> prefix_vec;
+    std::vector<int> prefix_steps;
+    // buffers of the language model queries of a frame
+    LmBatchScratch lm_batch;
+
+    // scores of the beam in parallel arrays indexed by beam slot, for the blank and repeat
+    // updates of a frame. The slots may hold the beams of several states, one after the other,
+    // see DecoderState::next_lockstep()
+    struct BeamScores {
+        std::vector<float> score;
+        std::vector<float> score_hw;
+        std::vector<float> log_prob_nb_prev;
+        std::vector<float> log_prob_nb_prev_hw;
+        // log probabilities of the blank and of the last token of the prefix in the frame
+        std::vector<float> log_prob_blank;
+        std::vector<float> log_prob_repeat;
+        // score below which the prefix isn't updated, see DecoderState::frame_min_cutoff
+        std::vector<float> min_cutoff;
+        std::vector<float> log_prob_b_cur;
+        std::vector<float> log_prob_b_cur_hw;
+        std::vector<float> log_prob_nb_cur;
+        std::vector<float> log_prob_nb_cur_hw;
+
+        void resize(size_t num_prefixes)
+        {
+            for (auto* scores : { &score,
+                                  &score_hw,
+                                  &log_prob_nb_prev,
+                                  &log_prob_nb_prev_hw,
+                                  &log_prob_blank,
+                                  &log_prob_repeat,
+                                  &min_cutoff,
+                                  &log_prob_b_cur,
+                                  &log_prob_b_cur_hw,
+                                  &log_prob_nb_cur,
+                                  &log_prob_nb_cur_hw }) {
+                scores->resize(num_prefixes);
+            }
+        }
+    };
+    BeamScores beam;
+    // log probability of each token in the frame, indexed by token + 1
+    std::vector<float> frame_log_probs;
+
+    // prefixes ranked by decode(), with their final scores
+    std::vector<PathTrie*> prefixes;
+    std::unordered_map<const PathTrie*, float> scores;
+};
+
+/* Pruned tokens of a chunk of consecutive frames, filled by the pruning stage of
+ * DecoderState::next() ahead of the beam search
+ */
+struct PrunedChunk {
+    std::vector<std::vector<std::pair<size_t, float>>> log_prob_idx;
+    std::vector<std::pair<int, double>> prob_idx;
+};
+
 class DecoderState {
     int abs_time_step;
     int space_id;
@@ -63,8 +159,181 @@ class DecoderState {
     HotwordScorer* hotword_scorer;
 
     std::vector<PathTrie*> prefixes;
+    // lowest score_hw of the prefixes, which are kept unsorted between frames
+    float worst_beam_score;
+    // best of the prefixes, by the score they are ranked with between frames
+    PathTrie* best_prefix;
+    // the beam was collapsed to its best prefix at a confident word boundary, and the frames
+    // have been confident since, see DecoderOptions::greedy_margin
+    bool greedy_span;
+    // the language model lookahead of the lexicon is applied to the partial words
+    bool lm_lookahead;
+    PathTriePool node_pool;
     PathTrie root;
 
+    DecoderScratch scratch;
+
+    /* Features of the decoder configuration. The expansion of a frame is compiled for each set
+     * of features, so that the branches on the configuration and the bookkeeping of the unused
+     * features are resolved at compile time rather than for every prefix and token.
+     */
+    enum Feature : unsigned {
+        FEATURE_SCORER = 1 << 0,
+        FEATURE_HOTWORDS = 1 << 1,
+        FEATURE_BPE = 1 << 2,
+        // the scorer has a lexicon
+        FEATURE_LEXICON = 1 << 3,
+        // the language model scores every token rather than complete words
+        FEATURE_SUBWORD_LM = 1 << 4,
+    };
+    static constexpr size_t NUM_FEATURE_SETS = 1 << 5;
+
+    using ExpandFunction
+        = void (DecoderState::*)(const std::vector<std::pair<size_t, float>>& log_prob_idx,
+                                 const DecoderScratch::BeamScores& beam,
+                                 size_t offset);
+
+    // expansion of a frame specialized for the features of the configuration
+    ExpandFunction expand_frame_function;
+
+    template <unsigned Features>
+    void expand_frame(const std::vector<std::pair<size_t, float>>& log_prob_idx,
+                      const DecoderScratch::BeamScores& beam,
+                      size_t offset);
+
+    // score below which a prefix isn't extended in the current frame, -inf unless the beam is
+    // full. The worst score of the beam is known since the pruning of the previous frame, so
+    // the prefixes don't need to be sorted
+    float frame_min_cutoff;
+
+    // number of prefixes of the beam extended in a frame
+    size_t num_beam_slots() const { return std::min(prefixes.size(), options->beam_width); }
+
+    // the blank and repeat updates of a frame, in three steps so that the beams of several
+    // states share the arrays of their updates: copy the scores of the beam to the slots of
+    // beam from offset, update all the slots, and copy the results back to the prefixes
+    void gather_beam_scores(const std::vector<double>& prob,
+                            const std::vector<std::pair<size_t, float>>& log_prob_idx,
+                            DecoderScratch::BeamScores& beam,
+                            size_t offset);
+    template <bool HasHotwords>
+    static void update_blanks_and_repeats(DecoderScratch::BeamScores& beam, size_t num_slots);
+    template <unsigned Features>
+    void scatter_beam_scores(const DecoderScratch::BeamScores& beam, size_t offset);
+
+    // extend the prefixes with the pruned tokens of a frame, and keep the best ones
+    void advance_frame(const std::vector<double>& prob,
+                       const std::vector<std::pair<size_t, float>>& log_prob_idx);
+
+    // the stages of advance_frame(): the expansion, which queues the language model queries,
+    // and the pruning once the queries are scored
+    void begin_frame(const std::vector<double>& prob,
+                     const std::vector<std::pair<size_t, float>>& log_prob_idx);
+    void end_frame();
+
+    // prune the tokens of a frame with cutoff_top_n, or with its width narrowed to meet the
+    // deadline, into the scratch buffers
+    const std::vector<std::pair<size_t, float>>& prune_frame(const std::vector<double>& prob,
+                                                             bool has_deadline);
+
+    // select the tokens expanded in a frame, the top token alone in a confident frame, and set
+    // the beam width of the frame
+    const std::vector<std::pair<size_t, float>>&
+    select_candidates(const std::vector<double>& prob,
+                      const std::vector<std::pair<size_t, float>>& log_prob_idx);
+
+    // beam width of the current frame, 1 in a greedy span
+    size_t frame_beam_width;
+
+    // deadline of the current call of next(), or of the stream, see DecoderOptions::deadline_ms
+    std::chrono::steady_clock::time_point deadline;
+    // the deadline of the stream was set by its first call of next()
+    bool deadline_started;
+    // start of the current window of frames whose time projects the remaining frames
+    std::chrono::steady_clock::time_point window_start_time;
+    // beam width and number of candidates per frame, narrowed to meet the deadline
+    size_t deadline_beam_width;
+    size_t deadline_cutoff_top_n;
+    // the beam was narrowed or frames were skipped to meet the deadline of the current call, or
+    // of the stream, see DecoderOptions::deadline_scope
+    bool degraded;
+
+    // tokens of the common prefix of the beam committed out of the trie and not taken yet, see
+    // DecoderOptions::commit_prefix
+    Output committed;
+
+    // commit the common prefix of the beam, and re-root the trie at its context tail
+    void commit_common_prefix();
+
+    // beam width narrowed to keep the trie within its budget, see DecoderOptions::max_trie_nodes
+    size_t budget_beam_width;
+
+    // keep the beam_width best prefixes, and remove the others from the trie
+    void keep_best_prefixes(size_t beam_width);
+
+    // narrow the beam and compact the trie while it is over budget, or widen the beam back once
+    // it is well under budget
+    void enforce_node_budget();
+
+    // number of frames between two projections of the time of the remaining frames
+    static constexpr size_t DEADLINE_WINDOW_SIZE = 8;
+
+    // start the deadline of a call of next(), or only its first window of frames when the
+    // deadline of the stream already runs
+    void start_deadline();
+
+    // check the deadline before the frame time_step of the num_time_steps frames of a call,
+    // and narrow the beam when the remaining frames are projected past it. Return false once
+    // it passed, the remaining frames being skipped
+    bool meet_deadline(size_t time_step, size_t num_time_steps);
+
+    // frames decoded since the last yield to the waiting streaming chunks, counted across the
+    // calls of next(), see DecoderOptions::preemption_frames
+    size_t frames_since_yield;
+
+    // count a decoded frame, and let the waiting streaming chunks run once preemption_frames
+    // frames were decoded since the last yield, when this is offline work
+    void count_preemption_frame();
+
+    // number of frames in a chunk of the pruning stage
+    static constexpr size_t PRUNE_CHUNK_SIZE = 16;
+
+    // threads of the pruning stage, and the ring of the chunks being pruned ahead
+    std::unique_ptr<ThreadPool> prune_pool;
+    std::vector<PrunedChunk> pruned_chunks;
+
+    // search of next() over the frames, pruned one by one
+    void next_serial(const std::vector<std::vector<double>>& probs_seq, bool has_deadline);
+
+    // same as next_serial(), with the frames pruned ahead by the pruning stage
+    void next_pipelined(const std::vector<std::vector<double>>& probs_seq, bool has_deadline);
+
+    template <size_t... Features>
+    static constexpr std::array<ExpandFunction, sizeof...(Features)>
+    make_expand_functions(std::index_sequence<Features...>);
+
+    static ExpandFunction select_expand_function(unsigned features);
+
+    // new path waiting for the language model score of its n-gram
+    struct LmExpansion {
+        PathTrie* path;
+        float log_prob_c;
+        float lm_score;
+        bool reset_score;
+        size_t query_id;
+    };
+
+    // language model queries of the current frame, deduplicated by n-gram
+    std::vector<LmExpansion> lm_expansions;
+    NgramBatch lm_queries;
+    std::vector<double> lm_query_scores;
+
+    size_t add_lm_query(PathTrie* prefix_to_score);
+
+    void score_lm_queries();
+
+    void apply_lm_expansions();
+
 public:
     /* Initialize CTC beam search decoder for streaming
      *
@@ -78,9 +347,12 @@ public:
      *                  words. Default null, decoding the input sample without hotword scorer
      */
     DecoderState(DecoderOptions* options, Scorer* ext_scorer, HotwordScorer* hotword_scorer);
-    ~DecoderState() = default;
+    ~DecoderState();
 
     /* Process logits in decoder stream
+     *
+     * When options->num_prune_threads is set and the chunk is long enough, the frames are
+     * pruned in parallel ahead of the beam search, which consumes them in order.
      *
      * Parameters:
      *     probs: 2-D vector where each element is a vector of probabilities
@@ -88,8 +360,36 @@ public:
      */
     void next(const std::vector<std::vector<double>>& probs_seq);
 
+    /* Process logits of several decoder streams in lockstep
+     *
+     * All the states advance together one frame at a time. The blank and repeat updates of a
+     * frame run over the beams of all the states in the same arrays, and its language model
+     * queries are scored in one batch for all the states, which must share their scorer and
+     * hotword scorer. The deadline, the yields and the commit of the common prefix apply to
+     * each state as in next(), the frames being pruned one by one.
+     *
+     * Parameters:
+     *     states: decoder states of the streams.
+     *     probs_seqs: frames of each stream, of any length.
+     */
+    static void
+    next_lockstep(const std::vector<DecoderState*>& states,
+                  const std::vector<const std::vector<std::vector<double>>*>& probs_seqs);
+
+    /* Start the search after the tail of a previous result, which gives the language model
+     * its context: the tokens of the last max_order words, or of the last max_order tokens of
+     * a character or bpe based model. Called before the first frame. The seeded tokens lead
+     * the results, at timestep -1.
+     *
+     * Parameters:
+     *     context: previous result, e.g. of the segment before a cut of a long sequence.
+     */
+    void seed_context(const Output& context);
+
+    template <unsigned Features>
     bool is_start_of_word(PathTrie* path);
 
+    template <unsigned Features>
     void update_score(PathTrie* path, float log_prob_c, float lm_score, bool reset_score);
 
     /* Get current transcription from the decoder stream state
@@ -99,6 +399,46 @@ public:
      *     in descending order.
      */
     std::vector<std::pair<double, Output>> decode();
+
+    /* Get the best transcription of the stream so far, cheap enough to be called after every
+     * chunk. Unlike decode(), it neither copies nor re-ranks the prefixes: it reads the path of
+     * the best prefix of the last frame, whose score has the language model scores of its
+     * complete words only, and prepends the committed tokens.
+     *
+     * Return:
+     *     A pair of the beam score of the best prefix and its decoding result.
+     */
+    std::pair<double, Output> best_partial() const;
+
+    // options of the decoder
+    const DecoderOptions* get_options() const { return options; }
+
+    /* Take the tokens committed since the last call, see DecoderOptions::commit_prefix
+     *
+     * Return:
+     *     The committed tokens and their timesteps, which decode() no longer prepends.
+     */
+    Output take_committed();
+
+    // number of nodes of the trie, without its root
+    size_t num_trie_nodes() const { return node_pool.num_live_nodes(); }
+
+    // number of nodes allocated for the trie, including the nodes kept for reuse, see
+    // PathTriePool::num_allocated_nodes()
+    size_t num_allocated_trie_nodes() const { return node_pool.num_allocated_nodes(); }
+
+    /* Decode with the copy of the lexicon of the scorer for a NUMA node, see
+     * DecoderOptions::replicate_lexicon. Does nothing once the stream has started, or without
+     * a lexicon.
+     *
+     * Parameters:
+     *     node: NUMA node of the thread decoding the stream.
+     */
+    void use_lexicon_replica(size_t node);
+
+    // worker of the StreamWorkerPool which decodes the chunks of the stream, assigned on its
+    // first chunk
+    size_t home_worker;
 };
 
 std::vector<std::vector<std::pair<double, Output>>> ctc_beam_search_decoder_batch_with_states(
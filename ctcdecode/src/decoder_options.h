@@ -1,7 +1,45 @@
 #ifndef DECODER_OPTIONS_H
 #define DECODER_OPTIONS_H
 
+#include <cstdint>
 #include <string>
+#include <vector>
+
+/* Attributes of a token of the vocabulary, computed once per DecoderOptions so that the
+ * decoder looks them up instead of inspecting the label strings.
+ */
+struct TokenAttributes {
+    enum Flag : uint8_t {
+        SPACE = 1 << 0,
+        APOSTROPHE = 1 << 1,
+        // bpe token starting with the token separator, which continues the previous word
+        BPE_CONTINUATION = 1 << 2,
+    };
+
+    uint8_t flags;
+
+    bool is_space() const { return flags & SPACE; }
+    bool is_apostrophe() const { return flags & APOSTROPHE; }
+    bool is_bpe_continuation() const { return flags & BPE_CONTINUATION; }
+};
+
+// Placement of the workers of the streaming decoder on the cores of the machine
+enum class WorkerPinning : int {
+    // the workers run on any core
+    NONE = 0,
+    // each worker runs on a core of its own, spread round robin over the NUMA nodes
+    CORE = 1,
+    // each worker runs on the cores of a NUMA node, spread round robin over the nodes
+    NUMA_NODE = 2,
+};
+
+// Span of the time budget of DecoderOptions::deadline_ms
+enum class DeadlineScope : int {
+    // the budget restarts with each call of the decoder, on a sequence or on a chunk of a stream
+    CHUNK = 0,
+    // the budget starts with the first chunk of a stream and runs over all its chunks
+    STREAM = 1,
+};
 
 class DecoderOptions {
 public:
@@ -45,6 +83,7 @@ public:
         , unk_score(unk_score)
         , token_separator(token_separator)
     {
+        compute_token_attributes();
     }
 
     /* Initialize DecoderOptions with vocabulary alone
@@ -55,9 +94,31 @@ public:
     DecoderOptions(std::vector<std::string> vocab)
         : vocab(vocab)
     {
+        compute_token_attributes();
     }
     ~DecoderOptions() = default;
 
+    // fill the attributes of the tokens, and the space and apostrophe ids
+    void compute_token_attributes()
+    {
+        token_attributes.resize(vocab.size());
+        for (size_t i = 0; i < vocab.size(); ++i) {
+            const std::string& token = vocab[i];
+            TokenAttributes& attributes = token_attributes[i];
+            attributes.flags = 0;
+            if (token == " ") {
+                attributes.flags |= TokenAttributes::SPACE;
+                space_id = static_cast<int>(i);
+            } else if (token == "'") {
+                attributes.flags |= TokenAttributes::APOSTROPHE;
+                apostrophe_id = static_cast<int>(i);
+            }
+            if (is_bpe_based && !token.empty() && token[0] == token_separator) {
+                attributes.flags |= TokenAttributes::BPE_CONTINUATION;
+            }
+        }
+    }
+
     std::vector<std::string> vocab;
     size_t beam_width = 100;
     size_t cutoff_top_n = 40;
@@ -68,6 +129,93 @@ public:
     bool is_bpe_based = false;
     float unk_score = -5;
     char token_separator = '#';
+    // number of threads pruning the upcoming frames of a long chunk ahead of the beam search,
+    // 0 prunes each frame in the beam search
+    size_t num_prune_threads = 0;
+    // when not 0, the number of candidates of each frame follows its entropy: it is the
+    // perplexity of the frame times adaptive_cutoff_scale, between min_cutoff_top_n and
+    // cutoff_top_n. 0 keeps cutoff_top_n candidates in every frame
+    size_t min_cutoff_top_n = 0;
+    double adaptive_cutoff_scale = 2.0;
+    // when not 0, the frames whose top token leads the second one by greedy_margin or more in
+    // probability are decoded greedily: they only expand their top token, and the beam is
+    // collapsed to its best prefix from a confident word boundary to the next uncertain frame.
+    // 0 runs the full beam search on every frame
+    double greedy_margin = 0.0;
+    // apply the language model lookahead of the lexicon while a word is formed, so that the
+    // partial words are ranked with the best score of their completions. Needs a word based
+    // scorer with a lexicon
+    bool lm_lookahead = false;
+    // long form decoding of the batch decoder: when not 0, a sequence is cut at the middle of
+    // its pauses of segment_min_pause frames or more whose blank probability is at least
+    // segment_blank_prob, and its segments are decoded then stitched together. A sequence cut
+    // into several segments has a single result: the best result of each segment, with the sum
+    // of their scores. 0 decodes every sequence whole.
+    // The language model context over a cut is set by the boundary handling:
+    //     segment_context_frames: the segments are decoded in parallel, each preceded by the
+    //         frames before its cut, whose decoded tokens approximate the context of the
+    //         previous segment and are dropped. 0 starts each segment without context.
+    //     segment_carry_context: the segments of a sequence are decoded one after the other,
+    //         each starting from the language model context of the best result of the previous
+    //         one, so that the context is the same as in a whole decode. Only the sequences of
+    //         the batch run in parallel. It excludes segment_context_frames
+    size_t segment_min_pause = 0;
+    double segment_blank_prob = 0.999;
+    size_t segment_context_frames = 0;
+    bool segment_carry_context = false;
+    // batch decoder engine: when true, each worker advances its share of the batch one frame
+    // at a time over all its utterances, updates the blanks and repeats of all their beams in
+    // the same arrays and scores their language model queries together. Suits large batches
+    // of short utterances. The frames are pruned one by one, without num_prune_threads. False
+    // decodes each utterance on its own. The engines of the batch decoder exclude each other:
+    // lockstep_batch, segment_min_pause and offline_priority can't be combined
+    bool lockstep_batch = false;
+    // placement of the workers of the streaming decoder, see WorkerPinning. All the states of a
+    // batch must have the same worker_pinning and replicate_lexicon. A pinned worker allocates
+    // the tries and the scratch buffers of its streams, so that they are on its NUMA node
+    WorkerPinning worker_pinning = WorkerPinning::NONE;
+    // with pinned workers, give the streams a copy of the lexicon made on the NUMA node of
+    // their worker, rather than the single copy of the scorer on the node which loaded it
+    bool replicate_lexicon = false;
+    // batch decoder: when true, the batch is decoded as low priority work on the workers of the
+    // streaming decoder with as many workers and the same worker_pinning, behind their
+    // streaming chunks. An utterance of the batch yields to the waiting streaming chunks every
+    // preemption_frames frames, so that they wait for one slice at most rather than for the
+    // whole utterance. False decodes the batch on workers of its own
+    bool offline_priority = false;
+    size_t preemption_frames = 50;
+    // when not 0, time budget in milliseconds of the decoder, over the span of deadline_scope.
+    // The decoder projects the time of the remaining frames of the call from its recent time
+    // per frame, and narrows beam_width and cutoff_top_n for the rest of the span when the
+    // projection passes the deadline. Once the deadline passes, the remaining frames of the span
+    // are skipped and the best results so far are returned. The results are then flagged as
+    // degraded, see Output::degraded. 0 decodes without a deadline
+    double deadline_ms = 0.0;
+    // span of deadline_ms, see DeadlineScope. The degraded flag and the narrowed widths follow
+    // the span: with CHUNK they are reset by each call, with STREAM they hold for the stream. A
+    // sequence decoded in one call has the same budget either way. The time between two chunks
+    // of a stream counts towards a STREAM budget, but not towards the time per frame
+    DeadlineScope deadline_scope = DeadlineScope::CHUNK;
+    // when not 0, budget of nodes of the trie of a decoder state. A state over budget narrows
+    // its beam for the next frames, halving it down to a single prefix until the trie fits,
+    // and frees the nodes kept for reuse. The beam widens back once the trie is under half the
+    // budget. The budget counts nodes rather than bytes: a node takes sizeof(PathTrie), plus
+    // the heap of its partial hotword when it is too long for the inline buffer of a string.
+    // 0 lets the trie grow with the beam
+    size_t max_trie_nodes = 0;
+    // after each call of DecoderState::next(), commit the longest common prefix of the beam:
+    // its tokens are final, so they move out of the trie, except for the tail the language
+    // model needs as context, and the trie is re-rooted there. The trie and the cost of
+    // decode() then stay bounded on endless streams. decode() prepends the committed tokens
+    // not taken by DecoderState::take_committed(). With a word language model, the scores
+    // returned by decode() keep the language model score of the committed words, which is the
+    // same for all the results, so it doesn't change their order
+    bool commit_prefix = false;
+
+    std::vector<TokenAttributes> token_attributes;
+    // ids of the space and apostrophe tokens, negative and distinct when absent
+    int space_id = -2;
+    int apostrophe_id = -3;
 };
 
 #endif // DECODER_OPTIONS_H
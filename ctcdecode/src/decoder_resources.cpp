@@ -0,0 +1,57 @@
+#include "decoder_resources.h"
+
+std::future<DecoderResources>
+load_decoder_resources_async(DecoderOptions* options,
+                             double alpha,
+                             double beta,
+                             const std::string& lm_path,
+                             const std::string& lm_type,
+                             const std::string& lexicon_fst_path,
+                             const std::string& shared_path,
+                             const std::string& load_method,
+                             const std::vector<std::vector<std::string>>& hotwords,
+                             const std::vector<float>& hotword_weights)
+{
+    return std::async(std::launch::async, [=]() {
+        auto start_time = LoadClock::now();
+        DecoderResources resources;
+
+        // the scorer loads its language model and lexicon on its own threads
+        std::future<Scorer*> scorer_loader;
+        if (!lm_path.empty()) {
+            scorer_loader = std::async(std::launch::async, [=]() {
+                return new Scorer(alpha,
+                                  beta,
+                                  lm_path,
+                                  options->vocab,
+                                  lm_type,
+                                  lexicon_fst_path,
+                                  shared_path,
+                                  load_method);
+            });
+        }
+
+        // compile the hotword FST meanwhile, it is released if the scorer fails to load
+        std::unique_ptr<HotwordScorer> hotword_scorer;
+        if (!hotwords.empty()) {
+            auto hotword_start_time = LoadClock::now();
+            hotword_scorer.reset(new HotwordScorer(options->vocab,
+                                                   hotwords,
+                                                   hotword_weights,
+                                                   options->token_separator,
+                                                   options->is_bpe_based));
+            resources.stats.hotword_seconds = seconds_since(hotword_start_time);
+        }
+
+        if (scorer_loader.valid()) {
+            resources.scorer = scorer_loader.get();
+            const LoadStats& scorer_stats = resources.scorer->get_load_stats();
+            resources.stats.lm_seconds = scorer_stats.lm_seconds;
+            resources.stats.lexicon_seconds = scorer_stats.lexicon_seconds;
+        }
+
+        resources.hotword_scorer = hotword_scorer.release();
+        resources.stats.total_seconds = seconds_since(start_time);
+        return resources;
+    });
+}
@@ -0,0 +1,51 @@
+#ifndef DECODER_RESOURCES_H_
+#define DECODER_RESOURCES_H_
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "decoder_options.h"
+#include "hotword_scorer.h"
+#include "load_stats.h"
+#include "scorer.h"
+
+/* Struct for the resources used by the decoder. The caller owns the scorers and releases them
+ * in the same way as the ones created separately.
+ */
+struct DecoderResources {
+    Scorer* scorer = nullptr;
+    HotwordScorer* hotword_scorer = nullptr;
+    LoadStats stats;
+};
+
+/* Load the decoder resources asynchronously
+ *
+ * The language model, the lexicon FST (when read from a file) and the hotword FST are loaded
+ * in parallel, so the cold start time is bounded by the slowest of them.
+ *
+ * Parameters:
+ *     options: DecoderOptions of the decoder, its vocabulary is used as the labels of
+ *              both scorers and must outlive them.
+ *     alpha, beta, lm_path, lm_type, lexicon_fst_path, shared_path, load_method: Same as the
+ *              parameters of Scorer. No scorer is created when lm_path is empty.
+ *     hotwords, hotword_weights: Same as the parameters of HotwordScorer. No hotword scorer
+ *              is created when hotwords is empty.
+ * Return:
+ *     A future of the loaded resources, along with the time spent in each stage. It rethrows
+ *     the failure of any of the loads.
+ */
+std::future<DecoderResources>
+load_decoder_resources_async(DecoderOptions* options,
+                             double alpha,
+                             double beta,
+                             const std::string& lm_path,
+                             const std::string& lm_type,
+                             const std::string& lexicon_fst_path,
+                             const std::string& shared_path,
+                             const std::string& load_method,
+                             const std::vector<std::vector<std::string>>& hotwords,
+                             const std::vector<float>& hotword_weights);
+
+#endif // DECODER_RESOURCES_H_
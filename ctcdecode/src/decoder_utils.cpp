@@ -4,6 +4,8 @@
 #include <bits/stdc++.h>
 #include <cmath>
 #include <limits>
+#include <sys/mman.h>
+#include <unistd.h>
 using namespace std;
 
 std::vector<std::pair<size_t, float>> get_pruned_log_probs(const std::vector<double>& prob_step,
@@ -12,6 +14,25 @@ std::vector<std::pair<size_t, float>> get_pruned_log_probs(const std::vector<dou
                                                            int log_input)
 {
     std::vector<std::pair<int, double>> prob_idx;
+    std::vector<std::pair<size_t, float>> log_prob_idx;
+    get_pruned_log_probs(prob_step, cutoff_prob, cutoff_top_n, log_input, prob_idx, log_prob_idx);
+    return log_prob_idx;
+}
+
+void get_pruned_log_probs(const std::vector<double>& prob_step,
+                          double cutoff_prob,
+                          size_t cutoff_top_n,
+                          int log_input,
+                          std::vector<std::pair<int, double>>& prob_idx,
+                          std::vector<std::pair<size_t, float>>& log_prob_idx,
+                          size_t min_cutoff_top_n,
+                          double adaptive_cutoff_scale)
+{
+    if (min_cutoff_top_n > 0) {
+        cutoff_top_n = get_adaptive_cutoff_top_n(
+            prob_step, log_input, min_cutoff_top_n, cutoff_top_n, adaptive_cutoff_scale);
+    }
+    prob_idx.clear();
     double log_cutoff_prob = log(cutoff_prob);
     for (size_t i = 0; i < prob_step.size(); ++i) {
         prob_idx.push_back(std::pair<int, double>(i, prob_step[i]));
@@ -19,7 +40,12 @@ std::vector<std::pair<size_t, float>> get_pruned_log_probs(const std::vector<dou
     // pruning of vacobulary
     size_t cutoff_len = prob_step.size();
     if (log_cutoff_prob < 0.0 || cutoff_top_n < cutoff_len) {
-        std::sort(prob_idx.begin(), prob_idx.end(), pair_comp_second_rev<int, double>);
+        // only the top cutoff_top_n tokens are ever kept, so only they need to be ranked
+        size_t num_ranked = std::min(std::max<size_t>(cutoff_top_n, 1), cutoff_len);
+        std::partial_sort(prob_idx.begin(),
+                          prob_idx.begin() + num_ranked,
+                          prob_idx.end(),
+                          pair_comp_second_rev<int, double>);
         if (log_cutoff_prob < 0.0) {
             double cum_prob = 0.0;
             cutoff_len = 0;
@@ -33,16 +59,86 @@ std::vector<std::pair<size_t, float>> get_pruned_log_probs(const std::vector<dou
         } else {
             cutoff_len = cutoff_top_n;
         }
-        prob_idx
-            = std::vector<std::pair<int, double>>(prob_idx.begin(), prob_idx.begin() + cutoff_len);
+        prob_idx.resize(cutoff_len);
     }
-    std::vector<std::pair<size_t, float>> log_prob_idx;
+    log_prob_idx.clear();
     for (size_t i = 0; i < cutoff_len; ++i) {
         log_prob_idx.push_back(std::pair<int, float>(
             prob_idx[i].first,
             log_input ? prob_idx[i].second : log(prob_idx[i].second + NUM_FLT_MIN)));
     }
-    return log_prob_idx;
+}
+
+double get_argmax_margin(const std::vector<double>& prob_step, int log_input, size_t& argmax)
+{
+    argmax = 0;
+    double first = -NUM_FLT_INF;
+    double second = -NUM_FLT_INF;
+    for (size_t i = 0; i < prob_step.size(); ++i) {
+        if (prob_step[i] > first) {
+            second = first;
+            first = prob_step[i];
+            argmax = i;
+        } else if (prob_step[i] > second) {
+            second = prob_step[i];
+        }
+    }
+    if (log_input) {
+        return exp(first) - exp(second);
+    }
+    return first - max(second, 0.0);
+}
+
+std::vector<std::pair<size_t, size_t>>
+get_blank_segments(const std::vector<std::vector<double>>& probs_seq,
+                   size_t blank_id,
+                   int log_input,
+                   double blank_prob,
+                   size_t min_pause_frames)
+{
+    std::vector<std::pair<size_t, size_t>> segments;
+    double threshold = log_input ? log(blank_prob) : blank_prob;
+    size_t num_time_steps = probs_seq.size();
+    size_t begin = 0;
+    size_t pause_begin = 0;
+    for (size_t time_step = 0; time_step <= num_time_steps; ++time_step) {
+        if (time_step < num_time_steps && probs_seq[time_step][blank_id] >= threshold) {
+            continue;
+        }
+        // a pause ends here, cut in its middle unless it's at an end of the sequence
+        size_t pause_end = time_step;
+        if (pause_end - pause_begin >= min_pause_frames && pause_begin > 0
+            && pause_end < num_time_steps) {
+            size_t cut = pause_begin + (pause_end - pause_begin) / 2;
+            segments.emplace_back(begin, cut);
+            begin = cut;
+        }
+        pause_begin = time_step + 1;
+    }
+    segments.emplace_back(begin, num_time_steps);
+    return segments;
+}
+
+size_t get_adaptive_cutoff_top_n(const std::vector<double>& prob_step,
+                                 int log_input,
+                                 size_t min_cutoff_top_n,
+                                 size_t max_cutoff_top_n,
+                                 double adaptive_cutoff_scale)
+{
+    // entropy of the frame in nats, the probabilities are assumed normalized
+    double entropy = 0.0;
+    for (double value : prob_step) {
+        double prob = log_input ? exp(value) : value;
+        if (prob > 0.0) {
+            entropy -= prob * (log_input ? value : log(prob));
+        }
+    }
+    // the tolerance keeps the rounding error of the entropy from adding a candidate
+    double num_candidates = ceil(adaptive_cutoff_scale * exp(entropy) - 1e-6);
+    if (!(num_candidates < max_cutoff_top_n)) {
+        return max(min_cutoff_top_n, max_cutoff_top_n);
+    }
+    return max(min_cutoff_top_n, static_cast<size_t>(num_candidates));
 }
 
 std::vector<std::pair<double, Output>>
@@ -71,7 +167,7 @@ get_beam_search_result(const std::vector<PathTrie*>& prefixes, size_t beam_size)
     return output_vecs;
 }
 
-size_t get_utf8_str_len(const std::string& str)
+size_t get_utf8_str_len(std::string_view str)
 {
     size_t str_len = 0;
     for (char c : str) {
@@ -196,6 +292,91 @@ bool add_word_to_lexicon(const std::vector<std::string>& characters,
     return true; // return with successful adding
 }
 
+bool word_to_labels(std::string_view word,
+                    const std::unordered_map<std::string, int>& char_map,
+                    int SPACE_ID,
+                    std::vector<int>& labels)
+{
+    labels.clear();
+    // reused for each character, short strings don't allocate
+    std::string character;
+
+    size_t begin = 0;
+    while (begin < word.size()) {
+        // find the start of the next UTF-8 character
+        size_t end = begin + 1;
+        while (end < word.size() && (word[end] & 0xc0) == 0x80) {
+            ++end;
+        }
+        character.assign(word.data() + begin, end - begin);
+        begin = end;
+
+        if (character == " ") {
+            labels.push_back(SPACE_ID);
+        } else {
+            auto int_c = char_map.find(character);
+            if (int_c != char_map.end()) {
+                labels.push_back(int_c->second);
+            } else {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool add_word_to_lexicon(std::string_view word,
+                         const std::unordered_map<std::string, int>& char_map,
+                         bool add_space,
+                         int SPACE_ID,
+                         fst::StdVectorFst* lexicon)
+{
+    if (word.empty()) {
+        return false;
+    }
+
+    std::vector<int> int_word;
+    if (!word_to_labels(word, char_map, SPACE_ID, int_word)) {
+        return false; // return without adding
+    }
+
+    if (add_space) {
+        int_word.push_back(SPACE_ID);
+    }
+
+    add_word_to_fst(int_word, lexicon);
+    return true; // return with successful adding
+}
+
+bool advise_huge_pages(const void* addr, size_t length)
+{
+#ifdef MADV_HUGEPAGE
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(addr) + page_size - 1) & ~(page_size - 1);
+    uintptr_t end = (reinterpret_cast<uintptr_t>(addr) + length) & ~(page_size - 1);
+    if (end <= begin) {
+        return false;
+    }
+    return madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE) == 0;
+#else
+    return false;
+#endif
+}
+
+void prefault_memory(const void* addr, size_t length)
+{
+    if (length == 0) {
+        return;
+    }
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    const volatile char* bytes = static_cast<const volatile char*>(addr);
+    volatile char sink = 0;
+    for (size_t offset = 0; offset < length; offset += page_size) {
+        sink = sink ^ bytes[offset];
+    }
+    sink = sink ^ bytes[length - 1];
+}
+
 void set_char_map(const std::vector<std::string>& char_list,
                   std::unordered_map<std::string, int>& char_map,
                   int& space_id)
@@ -213,30 +394,3 @@ void set_char_map(const std::vector<std::string>& char_list,
         ++i;
     }
 }
-
-/**
- * @brief This methods returns true when the current node bpe token can be mergeable
- * with the parent node token.
- *
- * @param cur_token, current token string
- * @param cur_char, id of current token
- * @param parent_char, id of parent token
- * @param apostrophe_id, id of apostrophe
- * @param token_separator, bpe token separator character, Ex: '#'
- * @return true, if the current node token merges with the parent token
- * @return false, if the current node token does not merge with the parent token
- */
-bool is_mergeable_bpe_token(std::string cur_token,
-                            int cur_char,
-                            int parent_char,
-                            int apostrophe_id,
-                            char token_separator)
-{
-
-    bool is_token_seperator = false;
-    if (cur_token.size() > 0) {
-        is_token_seperator = (cur_token.at(0) == token_separator);
-    }
-
-    return is_token_seperator || parent_char == apostrophe_id || cur_char == apostrophe_id;
-}
\ No newline at end of file
@@ -1,6 +1,9 @@
 #ifndef DECODER_UTILS_H_
 #define DECODER_UTILS_H_
 
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -14,12 +17,14 @@ const float NUM_FLT_MIN = std::numeric_limits<float>::min();
 const int NUM_INT_INF = std::numeric_limits<int>::max();
 const float NUM_FLT_LOGE = 0.4342944819;
 
-// inline function for validation check
+// inline function for validation check, which throws so that a failure on a worker thread
+// reaches the caller through its future, and python as a RuntimeError
 inline void check(bool x, const char* expr, const char* file, int line, const char* err)
 {
     if (!x) {
-        std::cout << "[" << file << ":" << line << "] ";
-        LOG(FATAL) << "\"" << expr << "\" check failed. " << err;
+        std::ostringstream message;
+        message << "[" << file << ":" << line << "] \"" << expr << "\" check failed. " << err;
+        throw std::runtime_error(message.str());
     }
 }
 
@@ -61,6 +66,40 @@ std::vector<std::pair<size_t, float>> get_pruned_log_probs(const std::vector<dou
                                                            size_t cutoff_top_n,
                                                            int log_input);
 
+// Same as above, into log_prob_idx with prob_idx as scratch space. The vectors keep their
+// capacity across calls, so that pruning doesn't allocate once they are large enough.
+// When min_cutoff_top_n is not 0, the number of candidates of the frame is adapted to its
+// entropy between min_cutoff_top_n and cutoff_top_n, see get_adaptive_cutoff_top_n()
+void get_pruned_log_probs(const std::vector<double>& prob_step,
+                          double cutoff_prob,
+                          size_t cutoff_top_n,
+                          int log_input,
+                          std::vector<std::pair<int, double>>& prob_idx,
+                          std::vector<std::pair<size_t, float>>& log_prob_idx,
+                          size_t min_cutoff_top_n = 0,
+                          double adaptive_cutoff_scale = 1.0);
+
+// Get the number of candidates of a frame from its entropy: the perplexity of the frame is the
+// number of tokens it effectively hesitates between, scaled and clamped to the bounds
+size_t get_adaptive_cutoff_top_n(const std::vector<double>& prob_step,
+                                 int log_input,
+                                 size_t min_cutoff_top_n,
+                                 size_t max_cutoff_top_n,
+                                 double adaptive_cutoff_scale);
+
+// Get the margin in probability between the top two tokens of a frame, and the top token
+double get_argmax_margin(const std::vector<double>& prob_step, int log_input, size_t& argmax);
+
+// Split a sequence into segments [begin, end) at the middle of the pauses, i.e. the runs of at
+// least min_pause_frames frames whose blank probability is blank_prob or more. Return a single
+// segment covering the sequence when it has no pause
+std::vector<std::pair<size_t, size_t>>
+get_blank_segments(const std::vector<std::vector<double>>& probs_seq,
+                   size_t blank_id,
+                   int log_input,
+                   double blank_prob,
+                   size_t min_pause_frames);
+
 // Get beam search result from prefixes in trie tree
 std::vector<std::pair<double, Output>>
 get_beam_search_result(const std::vector<PathTrie*>& prefixes, size_t beam_size);
@@ -75,7 +114,7 @@ bool prefix_compare_external_scores(const PathTrie* x,
 /* Get length of utf8 encoding string
  * See: http://stackoverflow.com/a/4063229
  */
-size_t get_utf8_str_len(const std::string& str);
+size_t get_utf8_str_len(std::string_view str);
 
 /* Split a string into a list of strings on a given string
  * delimiter. NB: delimiters on beginning / end of string are
@@ -98,14 +137,30 @@ bool add_word_to_lexicon(const std::vector<std::string>& characters,
                          int SPACE_ID,
                          fst::StdVectorFst* lexicon);
 
+// Get the lexicon labels of the UTF-8 characters of a word, false if a character isn't in
+// the char map
+bool word_to_labels(std::string_view word,
+                    const std::unordered_map<std::string, int>& char_map,
+                    int SPACE_ID,
+                    std::vector<int>& labels);
+
+// Add a word to lexicon, splitting it into UTF-8 characters in place
+bool add_word_to_lexicon(std::string_view word,
+                         const std::unordered_map<std::string, int>& char_map,
+                         bool add_space,
+                         int SPACE_ID,
+                         fst::StdVectorFst* lexicon);
+
+/* Request transparent huge pages for the whole pages inside the given memory region,
+ * to reduce TLB misses on large read-mostly data. Return false when not supported.
+ */
+bool advise_huge_pages(const void* addr, size_t length);
+
+// Touch every page of the given memory region, so it is resident before it is used
+void prefault_memory(const void* addr, size_t length);
+
 void set_char_map(const std::vector<std::string>& char_list,
                   std::unordered_map<std::string, int>& char_map,
                   int& space_id);
 
-bool is_mergeable_bpe_token(std::string cur_token,
-                            int cur_char,
-                            int parent_char,
-                            int apostrophe_id,
-                            char token_separator);
-
 #endif // DECODER_UTILS_H
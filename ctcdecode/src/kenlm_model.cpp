@@ -0,0 +1,162 @@
+#include "kenlm_model.h"
+
+#include <cstring>
+#include <unistd.h>
+
+#include "lm/state.hh"
+
+#include "decoder_utils.h"
+
+static_assert(sizeof(lm::ngram::State) <= sizeof(LmState),
+              "lm::ngram::State doesn't fit in LmState, KENLM_MAX_ORDER is too large");
+
+KenLMModel::KenLMModel(const std::string& lm_path,
+                       util::LoadMethod load_method,
+                       bool enumerate_vocab)
+{
+    model_ = nullptr;
+    model_type_ = lm::ngram::PROBING;
+
+    const char* filename = lm_path.c_str();
+    VALID_CHECK_EQ(access(filename, F_OK), 0, "Invalid language model path");
+
+    RetriveStrEnumerateVocab enumerate;
+    lm::ngram::Config config;
+    config.enumerate_vocab = enumerate_vocab ? &enumerate : nullptr;
+    config.load_method = load_method;
+    load_model(filename, config);
+    order_ = model_->Order();
+    vocabulary_ = std::move(enumerate.vocabulary);
+}
+
+KenLMModel::~KenLMModel()
+{
+    if (model_ != nullptr) {
+        delete model_;
+    }
+}
+
+/**
+ * @brief Loads the language model as its concrete KenLM type, which is detected from the
+ * header of the binary file. ARPA files are loaded as probing models, like KenLM does.
+ *
+ * @param filename, Path to the language model
+ * @param config, KenLM loading configuration
+ */
+void KenLMModel::load_model(const char* filename, const lm::ngram::Config& config)
+{
+    if (!lm::ngram::RecognizeBinary(filename, model_type_)) {
+        model_type_ = lm::ngram::PROBING;
+    }
+    switch (model_type_) {
+        case lm::ngram::PROBING:
+            model_ = new lm::ngram::ProbingModel(filename, config);
+            break;
+        case lm::ngram::REST_PROBING:
+            model_ = new lm::ngram::RestProbingModel(filename, config);
+            break;
+        case lm::ngram::TRIE:
+            model_ = new lm::ngram::TrieModel(filename, config);
+            break;
+        case lm::ngram::QUANT_TRIE:
+            model_ = new lm::ngram::QuantTrieModel(filename, config);
+            break;
+        case lm::ngram::ARRAY_TRIE:
+            model_ = new lm::ngram::ArrayTrieModel(filename, config);
+            break;
+        case lm::ngram::QUANT_ARRAY_TRIE:
+            model_ = new lm::ngram::QuantArrayTrieModel(filename, config);
+            break;
+        default:
+            VALID_CHECK(false, "Unsupported language model type");
+    }
+}
+
+/**
+ * @brief Calls the given function with the language model cast to its concrete type, so that
+ * the calls made by the function are resolved at compile time and can be inlined.
+ *
+ * @param function, generic callable taking the model as `const auto&`
+ * @return the value returned by the function
+ */
+template <class Function>
+auto KenLMModel::dispatch_model(Function&& function) const
+{
+    switch (model_type_) {
+        case lm::ngram::REST_PROBING:
+            return function(*static_cast<const lm::ngram::RestProbingModel*>(model_));
+        case lm::ngram::TRIE:
+            return function(*static_cast<const lm::ngram::TrieModel*>(model_));
+        case lm::ngram::QUANT_TRIE:
+            return function(*static_cast<const lm::ngram::QuantTrieModel*>(model_));
+        case lm::ngram::ARRAY_TRIE:
+            return function(*static_cast<const lm::ngram::ArrayTrieModel*>(model_));
+        case lm::ngram::QUANT_ARRAY_TRIE:
+            return function(*static_cast<const lm::ngram::QuantArrayTrieModel*>(model_));
+        default:
+            return function(*static_cast<const lm::ngram::ProbingModel*>(model_));
+    }
+}
+
+LmState KenLMModel::null_context_state() const
+{
+    LmState state;
+    std::memset(&state, 0, sizeof(state));
+    model_->NullContextWrite(&state);
+    return state;
+}
+
+/**
+ * @brief Scores a batch of tokens in two phases: the word indices of all the tokens are looked
+ * up first, then all the probes are made. The queries of a batch are independent, grouping
+ * the lookups and the probes lets their cache misses overlap instead of waiting on one
+ * query at a time.
+ *
+ * @param model, language model of a concrete KenLM type
+ */
+template <class Model>
+void KenLMModel::score(const Model& model,
+                       const std::vector<LmState>& states,
+                       const std::vector<std::string_view>& tokens,
+                       std::vector<float>& scores,
+                       std::vector<LmState>& new_states) const
+{
+    typedef typename Model::Vocabulary Vocabulary;
+    const Vocabulary& vocab = model.GetVocabulary();
+    size_t batch_size = tokens.size();
+
+    scores.resize(batch_size);
+    new_states.resize(batch_size);
+
+    // qualified call, which skips the virtual dispatch of lm::base::Vocabulary. The indices are
+    // kept per thread, as the model is shared, so that they keep their capacity across batches
+    static thread_local std::vector<lm::WordIndex> word_indices;
+    word_indices.resize(batch_size);
+    for (size_t i = 0; i < batch_size; ++i) {
+        StringPiece token(tokens[i].data(), tokens[i].size());
+        word_indices[i] = vocab.Vocabulary::Index(token);
+    }
+
+    lm::ngram::State in_state;
+    lm::ngram::State out_state;
+    for (size_t i = 0; i < batch_size; ++i) {
+        // encounter OOV
+        if (word_indices[i] == 0) {
+            scores[i] = OOV_SCORE;
+            continue;
+        }
+        std::memcpy(&in_state, &states[i], sizeof(lm::ngram::State));
+        // return  loge prob
+        scores[i] = model.Score(in_state, word_indices[i], out_state) / NUM_FLT_LOGE;
+        std::memcpy(&new_states[i], &out_state, sizeof(lm::ngram::State));
+    }
+}
+
+void KenLMModel::score(const std::vector<LmState>& states,
+                       const std::vector<std::string_view>& tokens,
+                       std::vector<float>& scores,
+                       std::vector<LmState>& new_states) const
+{
+    dispatch_model(
+        [&](const auto& model) { score(model, states, tokens, scores, new_states); });
+}
@@ -0,0 +1,73 @@
+#ifndef KENLM_MODEL_H_
+#define KENLM_MODEL_H_
+
+#include <string>
+
+#include "lm/config.hh"
+#include "lm/enumerate_vocab.hh"
+#include "lm/model.hh"
+#include "lm/word_index.hh"
+#include "util/string_piece.hh"
+
+#include "language_model.h"
+#include "string_arena.h"
+
+// Implement a callback to retrive the lexicon of language model.
+class RetriveStrEnumerateVocab : public lm::EnumerateVocab {
+public:
+    RetriveStrEnumerateVocab() { }
+
+    void Add(lm::WordIndex index, const StringPiece& str)
+    {
+        vocabulary.push_back(std::string_view(str.data(), str.length()));
+    }
+
+    StringArena vocabulary;
+};
+
+/* KenLM n-gram language model, loaded from an ARPA or a binary file.
+ *
+ * The model is kept as its concrete KenLM type, detected from the header of the binary file,
+ * so that the lookups and probes of a batch are non-virtual calls that can be inlined.
+ */
+class KenLMModel : public LanguageModel {
+public:
+    KenLMModel(const std::string& lm_path, util::LoadMethod load_method, bool enumerate_vocab);
+    ~KenLMModel();
+
+    size_t order() const override { return order_; }
+
+    LmState null_context_state() const override;
+
+    void score(const std::vector<LmState>& states,
+               const std::vector<std::string_view>& tokens,
+               std::vector<float>& scores,
+               std::vector<LmState>& new_states) const override;
+
+    StringArena take_vocabulary() override { return std::move(vocabulary_); }
+
+protected:
+    // load language model as its concrete type, detected from the binary file
+    void load_model(const char* filename, const lm::ngram::Config& config);
+
+    // call function with the language model cast to its concrete type
+    template <class Function>
+    auto dispatch_model(Function&& function) const;
+
+    template <class Model>
+    void score(const Model& model,
+               const std::vector<LmState>& states,
+               const std::vector<std::string_view>& tokens,
+               std::vector<float>& scores,
+               std::vector<LmState>& new_states) const;
+
+private:
+    // language model, an lm::base::Model of the concrete type model_type_
+    lm::base::Model* model_;
+    lm::ngram::ModelType model_type_;
+    size_t order_;
+
+    StringArena vocabulary_;
+};
+
+#endif // KENLM_MODEL_H_
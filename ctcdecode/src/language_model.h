@@ -0,0 +1,55 @@
+#ifndef LANGUAGE_MODEL_H_
+#define LANGUAGE_MODEL_H_
+
+#include <string_view>
+#include <vector>
+
+#include "string_arena.h"
+
+const double OOV_SCORE = -1000.0;
+
+/* Opaque state of a language model after a sequence of tokens. The content is defined by the
+ * backend, which must fit it in the storage and keep it trivially copyable: KenLM stores its
+ * lm::ngram::State, other backends may store an index into their own cache.
+ */
+struct LmState {
+    alignas(8) unsigned char data[64];
+};
+
+/* Interface of the language model backends used by the Scorer.
+ *
+ * Queries are batched: the decoder gathers every query of a frame and scores them in one call,
+ * which lets the backend amortize its per-call overhead (e.g. a forward pass of a neural model)
+ * and overlap the memory accesses of independent queries. A backend may run a batch
+ * asynchronously internally, score() only has to return when the whole batch is scored.
+ *
+ * score() is called concurrently by the decoders sharing a Scorer, so it must be thread safe.
+ */
+class LanguageModel {
+public:
+    virtual ~LanguageModel() = default;
+
+    // return the max order of the n-grams scored by the model
+    virtual size_t order() const = 0;
+
+    // return the state without any context, <s> is not inserted
+    virtual LmState null_context_state() const = 0;
+
+    /* Scores a batch of tokens, each conditioned on the context of its state.
+     *
+     * scores[i] is the loge probability of tokens[i] following states[i], or OOV_SCORE when the
+     * token is out of the vocabulary, in which case new_states[i] is unspecified. new_states[i]
+     * is the state after tokens[i]. The output vectors are resized to the size of the batch.
+     */
+    virtual void score(const std::vector<LmState>& states,
+                       const std::vector<std::string_view>& tokens,
+                       std::vector<float>& scores,
+                       std::vector<LmState>& new_states) const
+        = 0;
+
+    // return the vocabulary of the model, used to detect its tokenization and fill the
+    // lexicon. It is called once after loading, so the backend can give away its copy.
+    virtual StringArena take_vocabulary() = 0;
+};
+
+#endif // LANGUAGE_MODEL_H_
@@ -0,0 +1,25 @@
+#ifndef LOAD_STATS_H_
+#define LOAD_STATS_H_
+
+#include <chrono>
+
+using LoadClock = std::chrono::steady_clock;
+
+/* Struct for the time spent in each stage of loading the decoder resources, in seconds.
+ * Stages that are loaded in parallel overlap, so the total time is bounded by the slowest
+ * stage rather than the sum of all stages.
+ */
+struct LoadStats {
+    double lm_seconds = 0.0;
+    double lexicon_seconds = 0.0;
+    double hotword_seconds = 0.0;
+    double total_seconds = 0.0;
+};
+
+// Return the seconds elapsed since the given time point
+inline double seconds_since(LoadClock::time_point start_time)
+{
+    return std::chrono::duration<double>(LoadClock::now() - start_time).count();
+}
+
+#endif // LOAD_STATS_H_
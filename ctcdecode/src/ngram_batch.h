@@ -0,0 +1,151 @@
+#ifndef NGRAM_BATCH_H_
+#define NGRAM_BATCH_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* N-grams queued for one batch of language model queries, deduplicated on insertion. The words
+ * of all the n-grams are stored back to back in a single buffer, and the n-grams are found
+ * through a flat open addressing table of their indices. clear() keeps the capacity of all the
+ * buffers, so a decoder in the steady state queues the n-grams of a frame without allocating.
+ *
+ * Example:
+ *     NgramBatch batch;
+ *     size_t index = batch.insert({ "WORD1", "WORD2" });
+ *     std::string_view word = batch.word(index, 1);
+ */
+class NgramBatch {
+public:
+    // queue the n-gram unless the same n-gram is already queued, return its index
+    size_t insert(const std::vector<std::string>& ngram)
+    {
+        uint64_t hash = hash_ngram(ngram);
+        if ((size() + 1) * 2 > slots_.size()) {
+            grow_slots();
+        }
+        size_t mask = slots_.size() - 1;
+        for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+            if (slots_[slot] == 0) {
+                slots_[slot] = size() + 1;
+                break;
+            }
+            size_t index = slots_[slot] - 1;
+            if (hashes_[index] == hash && equals(index, ngram)) {
+                return index;
+            }
+        }
+
+        for (const auto& word : ngram) {
+            chars_.append(word);
+            word_ends_.push_back(chars_.size());
+        }
+        ngram_ends_.push_back(word_ends_.size());
+        hashes_.push_back(hash);
+        return size() - 1;
+    }
+
+    // append the n-grams of another batch, in order and without deduplicating them
+    void append(const NgramBatch& other)
+    {
+        for (size_t index = 0; index < other.size(); ++index) {
+            if ((size() + 1) * 2 > slots_.size()) {
+                grow_slots();
+            }
+            for (size_t position = 0; position < other.ngram_size(index); ++position) {
+                std::string_view word = other.word(index, position);
+                chars_.append(word.data(), word.size());
+                word_ends_.push_back(chars_.size());
+            }
+            ngram_ends_.push_back(word_ends_.size());
+            hashes_.push_back(other.hashes_[index]);
+            insert_slot(size() - 1);
+        }
+    }
+
+    size_t size() const { return ngram_ends_.size(); }
+
+    bool empty() const { return ngram_ends_.empty(); }
+
+    // return the number of words of an n-gram
+    size_t ngram_size(size_t index) const
+    {
+        return ngram_ends_[index] - (index == 0 ? 0 : ngram_ends_[index - 1]);
+    }
+
+    // return a word of an n-gram, valid until the next insertion
+    std::string_view word(size_t index, size_t position) const
+    {
+        size_t word_index = (index == 0 ? 0 : ngram_ends_[index - 1]) + position;
+        size_t begin = word_index == 0 ? 0 : word_ends_[word_index - 1];
+        return std::string_view(chars_.data() + begin, word_ends_[word_index] - begin);
+    }
+
+    // remove all the n-grams, keeping the memory for the next ones
+    void clear()
+    {
+        chars_.clear();
+        word_ends_.clear();
+        ngram_ends_.clear();
+        hashes_.clear();
+        slots_.assign(slots_.size(), 0);
+    }
+
+private:
+    // FNV-1a of the words, each terminated by a null character
+    static uint64_t hash_ngram(const std::vector<std::string>& ngram)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (const auto& word : ngram) {
+            for (size_t i = 0; i <= word.size(); ++i) {
+                hash ^= static_cast<unsigned char>(word.c_str()[i]);
+                hash *= 1099511628211ULL;
+            }
+        }
+        return hash;
+    }
+
+    bool equals(size_t index, const std::vector<std::string>& ngram) const
+    {
+        if (ngram_size(index) != ngram.size()) {
+            return false;
+        }
+        for (size_t position = 0; position < ngram.size(); ++position) {
+            if (word(index, position) != ngram[position]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void insert_slot(size_t index)
+    {
+        size_t mask = slots_.size() - 1;
+        size_t slot = hashes_[index] & mask;
+        while (slots_[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        slots_[slot] = index + 1;
+    }
+
+    // double the table, which is kept at most half full
+    void grow_slots()
+    {
+        slots_.assign(slots_.empty() ? 64 : slots_.size() * 2, 0);
+        for (size_t index = 0; index < size(); ++index) {
+            insert_slot(index);
+        }
+    }
+
+    std::string chars_;
+    // end offset in chars_ of each word
+    std::vector<size_t> word_ends_;
+    // end index in word_ends_ of each n-gram
+    std::vector<size_t> ngram_ends_;
+    std::vector<uint64_t> hashes_;
+    // index + 1 of the n-gram in each slot of the table, 0 for an empty slot
+    std::vector<size_t> slots_;
+};
+
+#endif // NGRAM_BATCH_H_
@@ -6,6 +6,9 @@
  */
 struct Output {
     std::vector<int> tokens, timesteps;
+    // the decoder narrowed its beam or skipped frames to meet its deadline, see
+    // DecoderOptions::deadline_ms
+    bool degraded = false;
 };
 
 #endif // OUTPUT_H_
@@ -2,7 +2,19 @@
 
 #include "decoder_utils.h"
 
-PathTrie::PathTrie()
+PathTrie::PathTrie() { reset(); }
+
+PathTrie::~PathTrie()
+{
+    PathTrie* child = first_child_;
+    while (child != nullptr) {
+        PathTrie* next_child = child->next_sibling_;
+        delete child;
+        child = next_child;
+    }
+}
+
+void PathTrie::reset()
 {
     log_prob_b_prev = -NUM_FLT_INF;
     log_prob_nb_prev = -NUM_FLT_INF;
@@ -38,13 +50,10 @@ PathTrie::PathTrie()
     hotword_matcher = nullptr;
     hotword_dictionary_state = 0;
     hotword_match_len = 0;
-}
 
-PathTrie::~PathTrie()
-{
-    for (auto child : children_) {
-        delete child.second;
-    }
+    first_child_ = nullptr;
+    next_sibling_ = nullptr;
+    pool_ = nullptr;
 }
 
 PathTrie* PathTrie::get_path_trie(int new_char,
@@ -53,30 +62,31 @@ PathTrie* PathTrie::get_path_trie(int new_char,
                                   bool reset,
                                   bool check_lexicon)
 {
-    auto child = children_.begin();
-    for (child = children_.begin(); child != children_.end(); ++child) {
-        if (child->first == new_char) {
-            if (child->second->log_prob_c < cur_log_prob_c) {
-                child->second->log_prob_c = cur_log_prob_c;
-                child->second->timestep = new_timestep;
+    PathTrie* child = first_child_;
+    PathTrie* last_child = nullptr;
+    for (; child != nullptr; last_child = child, child = child->next_sibling_) {
+        if (child->character == new_char) {
+            if (child->log_prob_c < cur_log_prob_c) {
+                child->log_prob_c = cur_log_prob_c;
+                child->timestep = new_timestep;
             }
             break;
         }
     }
-    if (child != children_.end()) {
-        if (!child->second->exists_) {
-            child->second->exists_ = true;
-            child->second->log_prob_b_prev = -NUM_FLT_INF;
-            child->second->log_prob_nb_prev = -NUM_FLT_INF;
-            child->second->log_prob_b_cur = -NUM_FLT_INF;
-            child->second->log_prob_nb_cur = -NUM_FLT_INF;
-            child->second->log_prob_b_prev_hw = -NUM_FLT_INF;
-            child->second->log_prob_nb_prev_hw = -NUM_FLT_INF;
-            child->second->log_prob_b_cur_hw = -NUM_FLT_INF;
-            child->second->log_prob_nb_cur_hw = -NUM_FLT_INF;
-            child->second->hotword_matcher = hotword_matcher;
+    if (child != nullptr) {
+        if (!child->exists_) {
+            child->exists_ = true;
+            child->log_prob_b_prev = -NUM_FLT_INF;
+            child->log_prob_nb_prev = -NUM_FLT_INF;
+            child->log_prob_b_cur = -NUM_FLT_INF;
+            child->log_prob_nb_cur = -NUM_FLT_INF;
+            child->log_prob_b_prev_hw = -NUM_FLT_INF;
+            child->log_prob_nb_prev_hw = -NUM_FLT_INF;
+            child->log_prob_b_cur_hw = -NUM_FLT_INF;
+            child->log_prob_nb_cur_hw = -NUM_FLT_INF;
+            child->hotword_matcher = hotword_matcher;
         }
-        return (child->second);
+        return child;
     } else {
         if (has_lexicon_ && check_lexicon) {
             matcher_->SetState(lexicon_state_);
@@ -107,12 +117,20 @@ PathTrie* PathTrie::get_path_trie(int new_char,
                     new_path->lexicon_state_ = matcher_->Value().nextstate;
                 }
 
-                children_.push_back(std::make_pair(new_char, new_path));
+                if (last_child != nullptr) {
+                    last_child->next_sibling_ = new_path;
+                } else {
+                    first_child_ = new_path;
+                }
                 return new_path;
             }
         } else {
             PathTrie* new_path = create_new_node(new_char, new_timestep, cur_log_prob_c);
-            children_.push_back(std::make_pair(new_char, new_path));
+            if (last_child != nullptr) {
+                last_child->next_sibling_ = new_path;
+            } else {
+                first_child_ = new_path;
+            }
             return new_path;
         }
     }
@@ -128,8 +146,9 @@ PathTrie* PathTrie::get_path_trie(int new_char,
  */
 PathTrie* PathTrie::create_new_node(int new_char, int new_timestep, float cur_log_prob_c)
 {
-    PathTrie* new_path = new PathTrie;
+    PathTrie* new_path = (pool_ != nullptr) ? pool_->acquire() : new PathTrie;
 
+    new_path->pool_ = pool_;
     new_path->character = new_char;
     new_path->timestep = new_timestep;
     new_path->parent = this;
@@ -171,18 +190,23 @@ PathTrie* PathTrie::get_path_vec(std::vector<int>& output,
     }
 }
 
-void PathTrie::iterate_to_vec(std::vector<PathTrie*>& output)
+void PathTrie::iterate_to_vec(std::vector<PathTrie*>& output, bool track_hotwords)
 {
     if (exists_) {
 
         log_prob_b_prev = log_prob_b_cur;
         log_prob_nb_prev = log_prob_nb_cur;
-
-        log_prob_b_prev_hw = log_prob_b_cur_hw;
-        log_prob_nb_prev_hw = log_prob_nb_cur_hw;
-
         score = log_sum_exp(log_prob_b_prev, log_prob_nb_prev);
-        score_hw = log_sum_exp(log_prob_b_prev_hw, log_prob_nb_prev_hw);
+
+        if (track_hotwords) {
+            log_prob_b_prev_hw = log_prob_b_cur_hw;
+            log_prob_nb_prev_hw = log_prob_nb_cur_hw;
+            score_hw = log_sum_exp(log_prob_b_prev_hw, log_prob_nb_prev_hw);
+        } else {
+            log_prob_b_prev_hw = log_prob_b_prev;
+            log_prob_nb_prev_hw = log_prob_nb_prev;
+            score_hw = score;
+        }
 
         log_prob_b_cur = -NUM_FLT_INF;
         log_prob_nb_cur = -NUM_FLT_INF;
@@ -191,8 +215,8 @@ void PathTrie::iterate_to_vec(std::vector<PathTrie*>& output)
 
         output.push_back(this);
     }
-    for (auto child : children_) {
-        child.second->iterate_to_vec(output);
+    for (PathTrie* child = first_child_; child != nullptr; child = child->next_sibling_) {
+        child->iterate_to_vec(output, track_hotwords);
     }
 }
 
@@ -200,32 +224,71 @@ void PathTrie::remove()
 {
     exists_ = false;
 
-    if (children_.size() == 0) {
-        auto child = parent->children_.begin();
-        for (child = parent->children_.begin(); child != parent->children_.end(); ++child) {
-            if (child->first == character) {
-                parent->children_.erase(child);
-                break;
-            }
-        }
+    if (first_child_ == nullptr) {
+        parent->remove_child(this);
 
-        if (parent->children_.size() == 0 && !parent->exists_) {
+        if (parent->first_child_ == nullptr && !parent->exists_) {
             parent->remove();
         }
 
-        delete this;
+        if (pool_ != nullptr) {
+            pool_->release(this);
+        } else {
+            delete this;
+        }
+    }
+}
+
+PathTrie* PathTrie::get_common_ancestor()
+{
+    PathTrie* node = this;
+    while (!node->exists_ && node->first_child_ != nullptr
+           && node->first_child_->next_sibling_ == nullptr) {
+        node = node->first_child_;
+    }
+    return node;
+}
+
+void PathTrie::reroot(PathTrie* descendant, std::vector<int>& tokens, std::vector<int>& timesteps)
+{
+    PathTrie* node = first_child_;
+    while (node != descendant) {
+        tokens.push_back(node->character);
+        timesteps.push_back(node->timestep);
+        PathTrie* child = node->first_child_;
+        node->first_child_ = nullptr;
+        if (pool_ != nullptr) {
+            pool_->release(node);
+        } else {
+            delete node;
+        }
+        node = child;
+    }
+    first_child_ = descendant;
+    descendant->parent = this;
+    descendant->next_sibling_ = nullptr;
+}
+
+void PathTrie::remove_child(PathTrie* child)
+{
+    PathTrie** link = &first_child_;
+    while (*link != nullptr && *link != child) {
+        link = &(*link)->next_sibling_;
+    }
+    if (*link != nullptr) {
+        *link = child->next_sibling_;
+        child->next_sibling_ = nullptr;
     }
 }
 
-void PathTrie::set_lexicon(fst::StdVectorFst* lexicon)
+void PathTrie::set_lexicon(const LexiconFst* lexicon)
 {
     lexicon_ = lexicon;
     lexicon_state_ = lexicon->Start();
     has_lexicon_ = true;
 }
 
-using FSTMATCH = fst::SortedMatcher<fst::StdVectorFst>;
-void PathTrie::set_matcher(std::shared_ptr<FSTMATCH> matcher) { matcher_ = matcher; }
+void PathTrie::set_matcher(std::shared_ptr<LexiconMatcher> matcher) { matcher_ = matcher; }
 
 /**
  * @brief Copies parent's hotword related params to the current node
@@ -263,7 +326,7 @@ bool PathTrie::is_oov_token()
 
     if (has_lexicon_) {
 
-        fst::StdVectorFst::StateId lexicon_state;
+        LexiconFst::StateId lexicon_state;
 
         // If this is the start token of the word, then set the lexicon state
         // to the start state of the lexicon, else
@@ -294,4 +357,45 @@ bool PathTrie::is_oov_token()
     }
 
     return false;
-}
\ No newline at end of file
+}
+
+PathTriePool::PathTriePool()
+    : free_nodes_(nullptr)
+    , num_nodes_(0)
+    , num_free_nodes_(0)
+{
+}
+
+PathTriePool::~PathTriePool() { trim(); }
+
+PathTrie* PathTriePool::acquire()
+{
+    if (free_nodes_ == nullptr) {
+        ++num_nodes_;
+        return new PathTrie;
+    }
+    PathTrie* node = free_nodes_;
+    free_nodes_ = node->next_sibling_;
+    --num_free_nodes_;
+    node->reset();
+    return node;
+}
+
+void PathTriePool::release(PathTrie* node)
+{
+    node->next_sibling_ = free_nodes_;
+    free_nodes_ = node;
+    ++num_free_nodes_;
+}
+
+void PathTriePool::trim()
+{
+    while (free_nodes_ != nullptr) {
+        PathTrie* node = free_nodes_;
+        free_nodes_ = node->next_sibling_;
+        node->next_sibling_ = nullptr;
+        delete node;
+    }
+    num_nodes_ -= num_free_nodes_;
+    num_free_nodes_ = 0;
+}
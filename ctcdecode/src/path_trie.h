@@ -9,6 +9,12 @@
 
 #include "fst/fstlib.h"
 
+// Lexicon FST in a read-only contiguous layout, which can be memory mapped from a file
+using LexiconFst = fst::StdConstFst;
+using LexiconMatcher = fst::SortedMatcher<LexiconFst>;
+
+class PathTriePool;
+
 /* Trie tree for prefix storing and manipulating, with a dictionary in
  * finite-state transducer for spelling correction.
  */
@@ -17,6 +23,10 @@ public:
     PathTrie();
     ~PathTrie();
 
+    // take the new nodes of the trie from pool and give them back to it when they are removed.
+    // Set on the root, before the trie grows
+    void set_pool(PathTriePool* pool) { pool_ = pool; }
+
     // get new prefix after appending new char
     PathTrie* get_path_trie(int new_char,
                             int new_timestep,
@@ -36,13 +46,14 @@ public:
     // creates new PathTrie* node
     PathTrie* create_new_node(int new_char, int new_timestep, float cur_log_prob_c);
 
-    // update log probs
-    void iterate_to_vec(std::vector<PathTrie*>& output);
+    // update log probs. Without hotwords, the hotword scores are copied from the original ones
+    // instead of being tracked separately
+    void iterate_to_vec(std::vector<PathTrie*>& output, bool track_hotwords = true);
 
     // set lexicon for FST
-    void set_lexicon(fst::StdVectorFst* lexicon);
+    void set_lexicon(const LexiconFst* lexicon);
 
-    void set_matcher(std::shared_ptr<fst::SortedMatcher<fst::StdVectorFst>>);
+    void set_matcher(std::shared_ptr<LexiconMatcher>);
 
     bool is_empty() { return ROOT_ == character; }
 
@@ -58,12 +69,24 @@ public:
 
     bool has_lexicon() { return has_lexicon_; }
 
+    // state of the lexicon after the characters of the current word
+    LexiconFst::StateId lexicon_state() const { return lexicon_state_; }
+
     // check if current token forms OOV word
     bool is_oov_token();
 
     // remove current path from root
     void remove();
 
+    // get the deepest node on the paths of all the prefixes of the trie, i.e. the end of their
+    // longest common prefix. Called on the root
+    PathTrie* get_common_ancestor();
+
+    // make a descendant the child of the root, called on the root. The nodes between them must
+    // be neither prefixes nor have other children: their tokens and timesteps are appended to
+    // the given vectors, and the nodes are freed
+    void reroot(PathTrie* descendant, std::vector<int>& tokens, std::vector<int>& timesteps);
+
     void reset_hotword_params();
     void copy_parent_hotword_params();
 
@@ -92,6 +115,14 @@ public:
     int hotword_match_len;
 
 private:
+    friend class PathTriePool;
+
+    // set all the members to their initial value
+    void reset();
+
+    // unlink the given child from the children list
+    void remove_child(PathTrie* child);
+
     int ROOT_;
     bool exists_;
     bool has_lexicon_;
@@ -99,13 +130,54 @@ private:
     bool is_hotpath_;
     bool is_word_start_char_;
 
-    std::vector<std::pair<int, PathTrie*>> children_;
+    // children, in creation order, linked through their next_sibling_
+    PathTrie* first_child_;
+    PathTrie* next_sibling_;
+
+    PathTriePool* pool_;
 
     // pointer to lexicon of FST
-    fst::StdVectorFst* lexicon_;
-    fst::StdVectorFst::StateId lexicon_state_;
+    const LexiconFst* lexicon_;
+    LexiconFst::StateId lexicon_state_;
     // true if finding ars in FST
-    std::shared_ptr<fst::SortedMatcher<fst::StdVectorFst>> matcher_;
+    std::shared_ptr<LexiconMatcher> matcher_;
+};
+
+/* Free list of PathTrie nodes. The nodes removed from a trie are kept for its next prefixes,
+ * so that a decoder in the steady state recycles nodes instead of allocating them every frame.
+ * The list is linked through the nodes themselves. A pool isn't thread safe, each DecoderState
+ * owns one.
+ */
+class PathTriePool {
+public:
+    PathTriePool();
+    ~PathTriePool();
+
+    PathTriePool(const PathTriePool&) = delete;
+    PathTriePool& operator=(const PathTriePool&) = delete;
+
+    // return a node in its initial state
+    PathTrie* acquire();
+
+    // keep a node without children for a later acquire()
+    void release(PathTrie* node);
+
+    // number of nodes acquired and not released, i.e. the nodes of the trie but its root
+    size_t num_live_nodes() const { return num_nodes_ - num_free_nodes_; }
+
+    // number of nodes allocated by the pool, in the trie or free. Their memory is this number
+    // times sizeof(PathTrie), plus the heap of the partial hotwords too long for the inline
+    // buffer of their string. The matchers are shared by all the nodes of a trie
+    size_t num_allocated_nodes() const { return num_nodes_; }
+
+    // free the nodes kept for a later acquire()
+    void trim();
+
+private:
+    PathTrie* free_nodes_;
+    // nodes allocated by the pool, and the free ones among them
+    size_t num_nodes_;
+    size_t num_free_nodes_;
 };
 
 #endif // PATH_TRIE_H
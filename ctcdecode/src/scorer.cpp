@@ -1,24 +1,24 @@
 #include "scorer.h"
 
+#include <cstdio>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <sys/stat.h>
 #include <unistd.h>
 
-#include "lm/config.hh"
-#include "lm/model.hh"
-#include "lm/state.hh"
-#include "util/string_piece.hh"
-#include "util/tokenize_piece.hh"
-
 #include "decoder_utils.h"
-
-using namespace lm::ngram;
+#include "kenlm_model.h"
 
 Scorer::Scorer(double alpha,
                double beta,
                const std::string& lm_path,
                const std::vector<std::string>& vocab_list,
                const std::string& lm_type,
-               const std::string& lexicon_fst_path)
+               const std::string& lexicon_fst_path,
+               const std::string& shared_path,
+               const std::string& load_method)
 {
     this->alpha = alpha;
     this->beta = beta;
@@ -28,81 +28,217 @@ Scorer::Scorer(double alpha,
     max_order_ = 0;
     dict_size_ = 0;
     SPACE_ID_ = -1;
+    has_lexicon_ = false;
+
+    auto method = StringToLoadMethod.find(load_method);
+    VALID_CHECK(method != StringToLoadMethod.end(), "Invalid load method");
+    load_method_ = method->second;
+
+    char_list_ = vocab_list;
+    setup(lm_path, vocab_list, lexicon_fst_path, shared_path);
+
+    const void* arcs = nullptr;
+    size_t arcs_length = 0;
+    if (load_method_ == util::READ && get_lexicon_arcs_region(&arcs, &arcs_length)) {
+        advise_huge_pages(arcs, arcs_length);
+    }
+}
+
+Scorer::Scorer(double alpha,
+               double beta,
+               LanguageModel* language_model,
+               const std::vector<std::string>& vocab_list,
+               const std::string& lm_type,
+               const std::string& lexicon_fst_path)
+{
+    VALID_CHECK(language_model != nullptr, "Invalid language model");
+    this->alpha = alpha;
+    this->beta = beta;
+    this->lm_type = StringToTokenizerType[lm_type];
+    lexicon = nullptr;
+    language_model_ = language_model;
+    max_order_ = 0;
+    dict_size_ = 0;
+    SPACE_ID_ = -1;
+    has_lexicon_ = false;
+    load_method_ = util::POPULATE_OR_READ;
 
     char_list_ = vocab_list;
-    setup(lm_path, vocab_list, lexicon_fst_path);
+    setup("", vocab_list, lexicon_fst_path, "");
 }
 
 Scorer::~Scorer()
 {
     if (language_model_ != nullptr) {
-        delete static_cast<lm::base::Model*>(language_model_);
+        delete language_model_;
     }
     if (lexicon != nullptr) {
-        delete static_cast<fst::StdVectorFst*>(lexicon);
+        delete static_cast<LexiconFst*>(lexicon);
     }
 }
 
 void Scorer::setup(const std::string& lm_path,
                    const std::vector<std::string>& vocab_list,
-                   const std::string& lexicon_fst_path)
+                   const std::string& lexicon_fst_path,
+                   const std::string& shared_path)
 {
+    auto start_time = LoadClock::now();
+
+    // attach to the resources published by another process, the vocabulary of the
+    // language model isn't needed in this case
+    if (!shared_path.empty() && shared_resources_match(shared_path, lm_path, lexicon_fst_path)) {
+        load_lm(lm_path, false);
+        set_char_map(vocab_list, char_map_, SPACE_ID_);
+        load_shared_resources(shared_path);
+        load_stats_.total_seconds = seconds_since(start_time);
+        return;
+    }
+
+    // reading a prebuilt FST doesn't depend on the language model, so it is
+    // loaded in parallel with the language model
+    std::future<void> lexicon_loader;
+    if (!lexicon_fst_path.empty()) {
+        lexicon_loader = std::async(
+            std::launch::async, &Scorer::load_lexicon, this, true, lexicon_fst_path);
+    }
+
     // load language model
     load_lm(lm_path);
     // set char map for scorer
     set_char_map(vocab_list, char_map_, SPACE_ID_);
-    // fill the dictionary for FST
-    if (is_word_based() || !lexicon_fst_path.empty()) {
+    // fill the dictionary for FST, which needs the vocabulary of the language model
+    if (lexicon_loader.valid()) {
+        lexicon_loader.get();
+    } else if (is_word_based()) {
         load_lexicon(true, lexicon_fst_path);
     }
+    if (has_lexicon_ && is_word_based()) {
+        load_lookahead();
+    }
+
+    if (!shared_path.empty()) {
+        publish_shared_resources(shared_path, lm_path, lexicon_fst_path);
+    }
+
+    // the vocabulary is only needed to fill the lexicon, release it
+    vocabulary_.clear();
+
+    load_stats_.total_seconds = seconds_since(start_time);
 }
 
-void Scorer::load_lm(const std::string& lm_path)
+void Scorer::load_lm(const std::string& lm_path, bool enumerate_vocab)
 {
-    const char* filename = lm_path.c_str();
-    VALID_CHECK_EQ(access(filename, F_OK), 0, "Invalid language model path");
-
-    RetriveStrEnumerateVocab enumerate;
-    lm::ngram::Config config;
-    config.enumerate_vocab = &enumerate;
-    language_model_ = lm::ngram::LoadVirtual(filename, config);
-    max_order_ = static_cast<lm::base::Model*>(language_model_)->Order();
-    vocabulary_ = enumerate.vocabulary;
-
-    if (!is_bpe_based()) {
-        for (auto it = vocabulary_.begin(); it != vocabulary_.end(); ++it) {
-            if (is_character_based() && *it != UNK_TOKEN && *it != START_TOKEN && *it != END_TOKEN
-                && get_utf8_str_len(*it) > 1) {
+    auto start_time = LoadClock::now();
+    // a backend given to the constructor is already loaded
+    if (language_model_ == nullptr) {
+        language_model_ = new KenLMModel(lm_path, load_method_, enumerate_vocab);
+    }
+    max_order_ = language_model_->order();
+    vocabulary_ = language_model_->take_vocabulary();
+
+    if (enumerate_vocab && !is_bpe_based()) {
+        for (std::string_view word : vocabulary_) {
+            if (is_character_based() && word != UNK_TOKEN && word != START_TOKEN
+                && word != END_TOKEN && get_utf8_str_len(word) > 1) {
                 lm_type = TokenizerType::WORD;
                 break; // terminate after `lm_type` is set
             }
         }
     }
+
+    load_stats_.lm_seconds = seconds_since(start_time);
 }
 
 double Scorer::get_log_cond_prob(const std::vector<std::string>& words)
 {
-    lm::base::Model* model = static_cast<lm::base::Model*>(language_model_);
-    double cond_prob;
-    lm::ngram::State state, tmp_state, out_state;
     // avoid to inserting <s> in begin
-    model->NullContextWrite(&state);
-    for (size_t i = 0; i < words.size(); ++i) {
-        lm::WordIndex word_index = 0;
-        if (words[i] != UNK_TOKEN) {
-            word_index = model->BaseVocabulary().Index(words[i]);
-        }
+    std::vector<LmState> states(1, language_model_->null_context_state());
+    std::vector<std::string_view> tokens(1);
+    std::vector<float> scores;
+    std::vector<LmState> new_states;
+
+    double cond_prob = 0.0;
+    for (const auto& word : words) {
         // encounter OOV
-        if (word_index == 0) {
+        if (word == UNK_TOKEN) {
+            return OOV_SCORE;
+        }
+        tokens[0] = word;
+        language_model_->score(states, tokens, scores, new_states);
+        if (scores[0] == OOV_SCORE) {
             return OOV_SCORE;
         }
-        cond_prob = model->BaseScore(&state, word_index, &out_state);
-        tmp_state = state;
-        state = out_state;
-        out_state = tmp_state;
+        cond_prob = scores[0];
+        states[0] = new_states[0];
+    }
+    return cond_prob;
+}
+
+/**
+ * @brief Scores a batch of n-grams, all advancing by one word at a time together. The words
+ * at the same position of all the n-grams are scored in one call to the language model, so a
+ * frame costs the backend one call per word position rather than one call per word.
+ *
+ * @param ngrams, n-grams to score
+ * @param scores, loge probability of the last word of each n-gram, or OOV_SCORE when any word
+ *                of the n-gram is out of the vocabulary
+ * @param scratch, buffers of the batch, which keep their capacity for the next batches
+ */
+void Scorer::get_log_cond_probs(const NgramBatch& ngrams,
+                                std::vector<double>& scores,
+                                LmBatchScratch& scratch)
+{
+    size_t num_ngrams = ngrams.size();
+    size_t max_length = 0;
+    for (size_t i = 0; i < num_ngrams; ++i) {
+        max_length = std::max(max_length, ngrams.ngram_size(i));
+    }
+
+    scores.assign(num_ngrams, 0.0);
+    std::vector<char>& is_oov = scratch.is_oov;
+    std::vector<LmState>& states = scratch.states;
+    is_oov.assign(num_ngrams, false);
+    states.assign(num_ngrams, language_model_->null_context_state());
+
+    std::vector<size_t>& batch_ids = scratch.batch_ids;
+    std::vector<LmState>& batch_states = scratch.batch_states;
+    std::vector<std::string_view>& batch_tokens = scratch.batch_tokens;
+    for (size_t j = 0; j < max_length; ++j) {
+        batch_ids.clear();
+        batch_states.clear();
+        batch_tokens.clear();
+        for (size_t i = 0; i < num_ngrams; ++i) {
+            if (is_oov[i] || j >= ngrams.ngram_size(i)) {
+                continue;
+            }
+            // an OOV word ends its n-gram with OOV_SCORE
+            std::string_view word = ngrams.word(i, j);
+            if (word == UNK_TOKEN) {
+                is_oov[i] = true;
+                scores[i] = OOV_SCORE;
+                continue;
+            }
+            batch_ids.push_back(i);
+            batch_states.push_back(states[i]);
+            batch_tokens.push_back(word);
+        }
+        if (batch_ids.empty()) {
+            break;
+        }
+
+        language_model_->score(
+            batch_states, batch_tokens, scratch.batch_scores, scratch.batch_new_states);
+        for (size_t k = 0; k < batch_ids.size(); ++k) {
+            size_t i = batch_ids[k];
+            if (scratch.batch_scores[k] == OOV_SCORE) {
+                is_oov[i] = true;
+                scores[i] = OOV_SCORE;
+            } else {
+                scores[i] = scratch.batch_scores[k];
+                states[i] = scratch.batch_new_states[k];
+            }
+        }
     }
-    // return  loge prob
-    return cond_prob / NUM_FLT_LOGE;
 }
 
 double Scorer::get_sent_log_prob(const std::vector<std::string>& words)
@@ -139,13 +275,38 @@ void Scorer::reset_params(float alpha, float beta)
     this->beta = beta;
 }
 
+void Scorer::warmup()
+{
+    const void* arcs = nullptr;
+    size_t arcs_length = 0;
+    if (get_lexicon_arcs_region(&arcs, &arcs_length)) {
+        prefault_memory(arcs, arcs_length);
+    }
+
+    // touch the vocabulary and the n-gram entries of the labels and the sentence markers
+    std::vector<std::string> ngram(max_order_, START_TOKEN);
+    get_log_cond_prob(ngram);
+    for (const auto& label : char_list_) {
+        ngram.back() = label;
+        get_log_cond_prob(ngram);
+    }
+    ngram.back() = END_TOKEN;
+    get_log_cond_prob(ngram);
+}
+
 std::string Scorer::vec2str(const std::vector<int>& input)
 {
     std::string word;
+    vec2str(input, word);
+    return word;
+}
+
+void Scorer::vec2str(const std::vector<int>& input, std::string& word)
+{
+    word.clear();
     for (auto ind : input) {
         word += char_list_[ind];
     }
-    return word;
 }
 
 std::vector<std::string> Scorer::split_labels(const std::vector<int>& labels)
@@ -166,12 +327,25 @@ std::vector<std::string> Scorer::split_labels(const std::vector<int>& labels)
 std::vector<std::string> Scorer::make_ngram(PathTrie* prefix)
 {
     std::vector<std::string> ngram;
+    std::vector<int> prefix_vec;
+    std::vector<int> prefix_steps;
+    make_ngram(prefix, ngram, prefix_vec, prefix_steps);
+    return ngram;
+}
+
+void Scorer::make_ngram(PathTrie* prefix,
+                        std::vector<std::string>& ngram,
+                        std::vector<int>& prefix_vec,
+                        std::vector<int>& prefix_steps)
+{
     PathTrie* current_node = prefix;
     PathTrie* new_node = nullptr;
 
-    for (int order = 0; order < max_order_; ++order) {
-        std::vector<int> prefix_vec;
-        std::vector<int> prefix_steps;
+    // the n-gram always has max_order_ words, it is filled from its last word
+    ngram.resize(max_order_);
+    for (size_t order = 0; order < max_order_; ++order) {
+        prefix_vec.clear();
+        prefix_steps.clear();
 
         if (is_character_based() || is_bpe_based()) {
             new_node = current_node->get_path_vec(prefix_vec, prefix_steps, -1, 1);
@@ -182,19 +356,16 @@ std::vector<std::string> Scorer::make_ngram(PathTrie* prefix)
         }
 
         // reconstruct word
-        std::string word = vec2str(prefix_vec);
-        ngram.push_back(word);
+        vec2str(prefix_vec, ngram[max_order_ - 1 - order]);
 
         if (new_node->character == -1) {
             // No more spaces, but still need order
-            for (int i = 0; i < max_order_ - order - 1; ++i) {
-                ngram.push_back(START_TOKEN);
+            for (size_t i = 0; i < max_order_ - order - 1; ++i) {
+                ngram[i] = START_TOKEN;
             }
             break;
         }
     }
-    std::reverse(ngram.begin(), ngram.end());
-    return ngram;
 }
 
 /**
@@ -204,26 +375,36 @@ std::vector<std::string> Scorer::make_ngram(PathTrie* prefix)
  */
 void Scorer::load_lexicon_from_fst_file(const std::string& lexicon_fst_path)
 {
-
-    auto startTime = std::chrono::high_resolution_clock::now();
-    fst::FstReadOptions read_options;
     // Read the FST from the file
     fst::StdVectorFst* dict = fst::StdVectorFst::Read(lexicon_fst_path);
-    if (!dict) {
-        std::cerr << "Failed to read FST from file: " << lexicon_fst_path << std::endl;
-        exit(EXIT_FAILURE);
-    }
+    VALID_CHECK(dict != nullptr, ("Failed to read FST from file: " + lexicon_fst_path).c_str());
 
-    auto endTime = std::chrono::high_resolution_clock::now();
-    auto duration
-        = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
-    // Convert duration to seconds
-    auto seconds = duration / 1000000.0;
-
-    std::cout << "Total time taken for reading the FST file: " << seconds << " seconds"
-              << std::endl;
+    this->lexicon = new LexiconFst(*dict);
+    delete dict;
+}
 
-    this->lexicon = dict;
+/**
+ * @brief Gets the copy of the lexicon for a NUMA node. The copy is made by the first caller of
+ * the node, so that the default first touch policy allocates its pages on the node of the
+ * caller. The copies are freed with the scorer
+ *
+ * @param node, NUMA node of the caller
+ * @return copy of the lexicon
+ */
+const LexiconFst* Scorer::get_lexicon_replica(size_t node)
+{
+    VALID_CHECK(has_lexicon_, "The scorer has no lexicon to replicate");
+    std::lock_guard<std::mutex> lock(lexicon_replicas_mutex_);
+    if (lexicon_replicas_.size() <= node) {
+        lexicon_replicas_.resize(node + 1);
+    }
+    if (!lexicon_replicas_[node]) {
+        // converting from the base class copies the states and arcs, where the copy
+        // constructor would share them
+        const fst::Fst<fst::StdArc>& lexicon_fst = *static_cast<LexiconFst*>(lexicon);
+        lexicon_replicas_[node] = std::make_unique<LexiconFst>(lexicon_fst);
+    }
+    return lexicon_replicas_[node].get();
 }
 
 /**
@@ -234,16 +415,15 @@ void Scorer::load_lexicon_from_fst_file(const std::string& lexicon_fst_path)
  */
 void Scorer::load_lexicon(bool add_space, const std::string& lexicon_fst_path)
 {
+    auto start_time = LoadClock::now();
     fst::StdVectorFst lexicon;
     // For each unigram convert to ints and put in trie
     int dict_size = 0;
     has_lexicon_ = true;
 
     if (lexicon_fst_path.empty()) {
-        for (const auto& word : vocabulary_) {
-            const auto& characters = split_utf8_str(word);
-            bool added
-                = add_word_to_lexicon(characters, char_map_, add_space, SPACE_ID_ + 1, &lexicon);
+        for (std::string_view word : vocabulary_) {
+            bool added = add_word_to_lexicon(word, char_map_, add_space, SPACE_ID_ + 1, &lexicon);
             dict_size += added ? 1 : 0;
         }
 
@@ -270,14 +450,312 @@ void Scorer::load_lexicon(bool add_space, const std::string& lexicon_fst_path)
          * memory usage of the dictionary
          */
         fst::Minimize(new_lexicon);
-        this->lexicon = new_lexicon;
+        this->lexicon = new LexiconFst(*new_lexicon);
+        delete new_lexicon;
 
     } else {
         load_lexicon_from_fst_file(lexicon_fst_path);
     }
 
-    if (lexicon.NumStates() == 0) {
+    // the lexicon read from a file is not in the local FST, so check the one kept by the scorer
+    if (static_cast<const LexiconFst*>(this->lexicon)->NumStates() == 0) {
         std::cout << "Lexicon is empty" << std::endl;
         has_lexicon_ = false;
     }
+
+    load_stats_.lexicon_seconds = seconds_since(start_time);
+}
+
+/**
+ * @brief Computes the language model lookahead of the lexicon states. Every word of the
+ * vocabulary is scored once without context, then walked through the lexicon, and each state
+ * on its path keeps the best score of the words going through it. The states only reachable by
+ * words unknown to the language model keep OOV_SCORE, like those words would get.
+ */
+void Scorer::load_lookahead()
+{
+    auto dict = static_cast<const LexiconFst*>(lexicon);
+    LexiconMatcher matcher(*dict, fst::MATCH_INPUT);
+    lookahead_.assign(dict->NumStates(), OOV_SCORE);
+
+    // the words are scored in batches, which bounds the memory of the states
+    const size_t batch_size = 4096;
+    std::vector<std::string_view> words;
+    std::vector<LmState> states(batch_size, language_model_->null_context_state());
+    std::vector<float> scores;
+    std::vector<LmState> new_states;
+    std::vector<int> labels;
+
+    auto walk_words = [&]() {
+        states.resize(words.size());
+        language_model_->score(states, words, scores, new_states);
+        for (size_t i = 0; i < words.size(); ++i) {
+            if (!word_to_labels(words[i], char_map_, SPACE_ID_ + 1, labels)) {
+                continue;
+            }
+            LexiconFst::StateId state = dict->Start();
+            for (int label : labels) {
+                matcher.SetState(state);
+                if (!matcher.Find(label)) {
+                    break;
+                }
+                state = matcher.Value().nextstate;
+                lookahead_[state] = std::max(lookahead_[state], scores[i]);
+            }
+        }
+        words.clear();
+    };
+
+    for (std::string_view word : vocabulary_) {
+        if (word == UNK_TOKEN || word == START_TOKEN || word == END_TOKEN) {
+            continue;
+        }
+        words.push_back(word);
+        if (words.size() == batch_size) {
+            walk_words();
+        }
+    }
+    if (!words.empty()) {
+        walk_words();
+    }
+
+    // no word is started at the start state, its score comes with the next word
+    lookahead_[dict->Start()] = 0.0;
+}
+
+/**
+ * @brief Writes the lexicon and the properties of the scorer derived from the language model
+ * vocabulary to the shared path, so that other processes can attach to them. The files are
+ * written to temporary paths and renamed, so a reader never sees a partially written file.
+ *
+ * @param shared_path, Path prefix of the shared files
+ * @param lm_path, Path of the language model the resources are derived from
+ * @param lexicon_fst_path, Path of the lexicon FST file, empty when the lexicon is built from
+ *                          the language model
+ */
+void Scorer::publish_shared_resources(const std::string& shared_path,
+                                      const std::string& lm_path,
+                                      const std::string& lexicon_fst_path)
+{
+    std::string pid_suffix = ".tmp" + std::to_string(getpid());
+
+    if (has_lexicon_) {
+        std::string tmp_fst_path = shared_path + pid_suffix;
+        std::ofstream fst_stream(tmp_fst_path, std::ios_base::out | std::ios_base::binary);
+        // aligned layout is required for the readers to memory map the FST
+        fst::FstWriteOptions write_options(tmp_fst_path);
+        write_options.align = true;
+        bool written = static_cast<LexiconFst*>(lexicon)->Write(fst_stream, write_options);
+        fst_stream.close();
+        if (!written || std::rename(tmp_fst_path.c_str(), shared_path.c_str()) != 0) {
+            std::cerr << "Failed to publish the lexicon to: " << shared_path << std::endl;
+            std::remove(tmp_fst_path.c_str());
+            return;
+        }
+    }
+
+    if (!lookahead_.empty()) {
+        std::string lookahead_path = shared_lookahead_path(shared_path);
+        std::string tmp_lookahead_path = lookahead_path + pid_suffix;
+        std::ofstream lookahead_stream(tmp_lookahead_path,
+                                       std::ios_base::out | std::ios_base::binary);
+        lookahead_stream.write(reinterpret_cast<const char*>(lookahead_.data()),
+                               lookahead_.size() * sizeof(float));
+        lookahead_stream.close();
+        if (lookahead_stream.fail()
+            || std::rename(tmp_lookahead_path.c_str(), lookahead_path.c_str()) != 0) {
+            std::cerr << "Failed to publish the lookahead to: " << lookahead_path << std::endl;
+            std::remove(tmp_lookahead_path.c_str());
+            return;
+        }
+    } else {
+        // a lookahead left by an earlier publication doesn't describe this lexicon
+        std::remove(shared_lookahead_path(shared_path).c_str());
+    }
+
+    // the metadata is published last, its presence marks the shared resources as complete
+    std::string meta_path = shared_meta_path(shared_path);
+    std::string tmp_meta_path = meta_path + pid_suffix;
+    SharedMeta meta = make_shared_meta(lm_path, lexicon_fst_path);
+    std::ofstream meta_stream(tmp_meta_path);
+    meta_stream << meta.lm_type << " " << meta.dict_size << " " << meta.has_lexicon << " "
+                << meta.num_labels << " " << meta.labels_hash << " " << meta.lexicon_states << " "
+                << meta.has_lookahead << " " << meta.lm_size << " " << meta.lm_mtime << " "
+                << meta.lexicon_size << " " << meta.lexicon_mtime << "\n"
+                << meta.lm_path << "\n"
+                << meta.lexicon_path << std::endl;
+    meta_stream.close();
+    if (meta_stream.fail() || std::rename(tmp_meta_path.c_str(), meta_path.c_str()) != 0) {
+        std::cerr << "Failed to publish the scorer metadata to: " << meta_path << std::endl;
+        std::remove(tmp_meta_path.c_str());
+    }
+}
+
+/**
+ * @brief Checks that the resources published at the shared path were built for the language
+ * model at lm_path and the lexicon FST at lexicon_fst_path, each identified by its path, size
+ * and modification time, and for the labels and tokenizer of this scorer. Stale resources are
+ * reported, the caller then rebuilds them.
+ *
+ * @param shared_path, Path prefix of the shared files
+ * @param lm_path, Path of the language model of the scorer
+ * @param lexicon_fst_path, Path of the lexicon FST file of the scorer, or empty
+ * @return true if the published resources can be attached to
+ */
+bool Scorer::shared_resources_match(const std::string& shared_path,
+                                    const std::string& lm_path,
+                                    const std::string& lexicon_fst_path)
+{
+    if (access(shared_meta_path(shared_path).c_str(), F_OK) != 0) {
+        return false;
+    }
+    SharedMeta published;
+    SharedMeta expected = make_shared_meta(lm_path, lexicon_fst_path);
+    // a character based type is turned into a word based one by a word language model
+    bool match = read_shared_meta(shared_path, published)
+                 && (published.lm_type == expected.lm_type
+                     || (expected.lm_type == TokenizerType::CHAR
+                         && published.lm_type == TokenizerType::WORD))
+                 && published.num_labels == expected.num_labels
+                 && published.labels_hash == expected.labels_hash
+                 && published.lm_path == expected.lm_path && published.lm_size == expected.lm_size
+                 && published.lm_mtime == expected.lm_mtime
+                 && published.lexicon_path == expected.lexicon_path
+                 && published.lexicon_size == expected.lexicon_size
+                 && published.lexicon_mtime == expected.lexicon_mtime;
+    if (!match) {
+        std::cerr << "Shared scorer at " << shared_path
+                  << " was built for another language model, lexicon or other labels, "
+                     "rebuilding it"
+                  << std::endl;
+    }
+    return match;
+}
+
+/**
+ * @brief Attaches to the resources published by another process. The lexicon is memory mapped
+ * read-only, so its pages are shared between all the processes using the same shared path.
+ *
+ * @param shared_path, Path prefix of the shared files
+ */
+void Scorer::load_shared_resources(const std::string& shared_path)
+{
+    auto start_time = LoadClock::now();
+
+    SharedMeta meta;
+    VALID_CHECK(read_shared_meta(shared_path, meta), "Invalid shared scorer metadata");
+    VALID_CHECK_EQ(meta.num_labels, char_list_.size(), "Shared scorer was built for other labels");
+    lm_type = static_cast<TokenizerType>(meta.lm_type);
+    dict_size_ = meta.dict_size;
+    has_lexicon_ = meta.has_lexicon;
+
+    if (has_lexicon_) {
+        std::ifstream fst_stream(shared_path, std::ios_base::in | std::ios_base::binary);
+        fst::FstReadOptions read_options(shared_path);
+        read_options.mode = fst::FstReadOptions::MAP;
+        LexiconFst* dict = LexiconFst::Read(fst_stream, read_options);
+        VALID_CHECK(dict != nullptr, "Failed to map the shared lexicon");
+        this->lexicon = dict;
+        VALID_CHECK_EQ(static_cast<size_t>(dict->NumStates()),
+                       meta.lexicon_states,
+                       "Shared lexicon doesn't match its metadata");
+
+        // the lookahead is one float per lexicon state
+        if (meta.has_lookahead) {
+            std::ifstream lookahead_stream(shared_lookahead_path(shared_path),
+                                           std::ios_base::in | std::ios_base::binary);
+            VALID_CHECK(lookahead_stream.is_open(), "Missing shared lexicon lookahead");
+            lookahead_.resize(dict->NumStates());
+            lookahead_stream.read(reinterpret_cast<char*>(lookahead_.data()),
+                                  lookahead_.size() * sizeof(float));
+            VALID_CHECK(!lookahead_stream.fail(), "Invalid shared lexicon lookahead");
+        }
+    }
+
+    load_stats_.lexicon_seconds = seconds_since(start_time);
+}
+
+Scorer::SharedMeta Scorer::make_shared_meta(const std::string& lm_path,
+                                            const std::string& lexicon_fst_path) const
+{
+    SharedMeta meta;
+    meta.lm_type = static_cast<int>(lm_type);
+    meta.dict_size = dict_size_;
+    meta.has_lexicon = has_lexicon_;
+    meta.num_labels = char_list_.size();
+    // FNV-1a of the labels, each terminated by a null character
+    meta.labels_hash = 14695981039346656037ULL;
+    for (const std::string& label : char_list_) {
+        for (size_t i = 0; i <= label.size(); ++i) {
+            meta.labels_hash ^= static_cast<unsigned char>(label.c_str()[i]);
+            meta.labels_hash *= 1099511628211ULL;
+        }
+    }
+    if (has_lexicon_ && lexicon != nullptr) {
+        meta.lexicon_states = static_cast<const LexiconFst*>(lexicon)->NumStates();
+    }
+    meta.has_lookahead = !lookahead_.empty();
+    struct stat lm_stat;
+    if (!lm_path.empty() && stat(lm_path.c_str(), &lm_stat) == 0) {
+        meta.lm_size = static_cast<uint64_t>(lm_stat.st_size);
+        meta.lm_mtime = static_cast<int64_t>(lm_stat.st_mtime);
+    }
+    struct stat lexicon_stat;
+    if (!lexicon_fst_path.empty() && stat(lexicon_fst_path.c_str(), &lexicon_stat) == 0) {
+        meta.lexicon_size = static_cast<uint64_t>(lexicon_stat.st_size);
+        meta.lexicon_mtime = static_cast<int64_t>(lexicon_stat.st_mtime);
+    }
+    meta.lm_path = lm_path;
+    meta.lexicon_path = lexicon_fst_path;
+    return meta;
+}
+
+bool Scorer::read_shared_meta(const std::string& shared_path, SharedMeta& meta)
+{
+    std::ifstream meta_stream(shared_meta_path(shared_path));
+    meta_stream >> meta.lm_type >> meta.dict_size >> meta.has_lexicon >> meta.num_labels
+        >> meta.labels_hash >> meta.lexicon_states >> meta.has_lookahead >> meta.lm_size
+        >> meta.lm_mtime >> meta.lexicon_size >> meta.lexicon_mtime;
+    // the paths are the second and third lines, they may contain spaces
+    meta_stream.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    std::getline(meta_stream, meta.lm_path);
+    std::getline(meta_stream, meta.lexicon_path);
+    return !meta_stream.fail();
+}
+
+std::string Scorer::shared_meta_path(const std::string& shared_path)
+{
+    return shared_path + ".meta";
+}
+
+std::string Scorer::shared_lookahead_path(const std::string& shared_path)
+{
+    return shared_path + ".lookahead";
+}
+
+bool Scorer::get_lexicon_arcs_region(const void** addr, size_t* length) const
+{
+    if (!has_lexicon_) {
+        return false;
+    }
+    // the arcs of all the states are stored contiguously in state order, so the region spans
+    // from the arcs of the first state having any to the end of the last state having any
+    auto dict = static_cast<const LexiconFst*>(lexicon);
+    const fst::StdArc* begin = nullptr;
+    const fst::StdArc* end = nullptr;
+    fst::ArcIteratorData<fst::StdArc> data;
+    for (LexiconFst::StateId state = 0; state < dict->NumStates() && begin == nullptr; ++state) {
+        dict->InitArcIterator(state, &data);
+        begin = data.narcs > 0 ? data.arcs : nullptr;
+    }
+    for (LexiconFst::StateId state = dict->NumStates() - 1; state >= 0 && end == nullptr; --state) {
+        dict->InitArcIterator(state, &data);
+        end = data.narcs > 0 ? data.arcs + data.narcs : nullptr;
+    }
+    if (begin == nullptr || end == nullptr) {
+        return false;
+    }
+    *addr = begin;
+    *length = (end - begin) * sizeof(fst::StdArc);
+    return true;
 }
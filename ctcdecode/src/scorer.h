@@ -1,18 +1,21 @@
 #ifndef SCORER_H_
 #define SCORER_H_
 
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 
-#include "lm/enumerate_vocab.hh"
-#include "lm/virtual_interface.hh"
-#include "lm/word_index.hh"
-#include "util/string_piece.hh"
+#include "lm/config.hh"
 
 #include "decoder_utils.h"
+#include "language_model.h"
+#include "load_stats.h"
+#include "ngram_batch.h"
 #include "path_trie.h"
+#include "string_arena.h"
 
-const double OOV_SCORE = -1000.0;
 const std::string START_TOKEN = "<s>";
 const std::string UNK_TOKEN = "[UNK]";
 const std::string END_TOKEN = "</s>";
@@ -24,17 +27,31 @@ static std::map<std::string, TokenizerType> StringToTokenizerType
         { "bpe", TokenizerType::BPE },
         { "word", TokenizerType::WORD } };
 
-// Implement a callback to retrive the lexicon of language model.
-class RetriveStrEnumerateVocab : public lm::EnumerateVocab {
-public:
-    RetriveStrEnumerateVocab() { }
-
-    void Add(lm::WordIndex index, const StringPiece& str)
-    {
-        vocabulary.push_back(std::string(str.data(), str.length()));
-    }
+/* How the language model is brought into memory:
+ *     lazy: memory map the binary file, pages are faulted in on first access.
+ *     populate: memory map the binary file and pre-fault it (default).
+ *     huge_pages: read the model into anonymous memory backed by transparent huge pages.
+ *                 The lexicon is also advised to use huge pages. The model is then private
+ *                 to the process, which opts out of the page cache sharing of shared_path.
+ */
+static std::map<std::string, util::LoadMethod> StringToLoadMethod
+    = { { "lazy", util::LAZY },
+        { "populate", util::POPULATE_OR_READ },
+        { "huge_pages", util::READ } };
 
-    std::vector<std::string> vocabulary;
+/* Buffers of Scorer::get_log_cond_probs(). They are owned by the caller, so that they keep their
+ * capacity across the batches of a decoder while the scorer is shared between threads.
+ */
+struct LmBatchScratch {
+    // the n-gram met an OOV word, and the language model state of each n-gram
+    std::vector<char> is_oov;
+    std::vector<LmState> states;
+    // the words at the same position of the n-grams, scored in one call to the language model
+    std::vector<size_t> batch_ids;
+    std::vector<LmState> batch_states;
+    std::vector<std::string_view> batch_tokens;
+    std::vector<float> batch_scores;
+    std::vector<LmState> batch_new_states;
 };
 
 /* External scorer to query score for n-gram or sentence, including language
@@ -44,6 +61,22 @@ public:
  *     Scorer scorer(alpha, beta, "path_of_language_model");
  *     scorer.get_log_cond_prob({ "WORD1", "WORD2", "WORD3" });
  *     scorer.get_sent_log_prob({ "WORD1", "WORD2", "WORD3" });
+ *
+ * When shared_path is given, the lexicon and the properties derived from the vocabulary of
+ * the language model are published there by the first process creating the scorer. Later
+ * processes memory map them read-only instead of rebuilding them, so they load in
+ * milliseconds and share the same physical pages. The language model itself is shared
+ * through the page cache when it is a KenLM binary file (ARPA files are parsed into private
+ * memory). The published metadata records the path, size and modification time of the
+ * language model and of the lexicon FST file, a hash of the labels and the size of the
+ * lexicon; resources published for another language model, lexicon or other labels are
+ * rebuilt and published again instead of being attached.
+ *
+ * The language model and lexicon pages are faulted in lazily unless the load_method says
+ * otherwise (see StringToLoadMethod), warmup() pre-faults them explicitly.
+ *
+ * The language model at lm_path is a KenLM model. Other backends implementing LanguageModel
+ * are given to the second constructor, which takes the ownership of the backend.
  */
 class Scorer {
 public:
@@ -52,11 +85,25 @@ public:
            const std::string& lm_path,
            const std::vector<std::string>& vocabulary,
            const std::string& lm_type,
+           const std::string& lexicon_fst_path,
+           const std::string& shared_path = "",
+           const std::string& load_method = "populate");
+    Scorer(double alpha,
+           double beta,
+           LanguageModel* language_model,
+           const std::vector<std::string>& vocabulary,
+           const std::string& lm_type,
            const std::string& lexicon_fst_path);
     ~Scorer();
 
     double get_log_cond_prob(const std::vector<std::string>& words);
 
+    // score a batch of n-grams, each the same way as get_log_cond_prob() does, with one call
+    // to the language model per word position
+    void get_log_cond_probs(const NgramBatch& ngrams,
+                            std::vector<double>& scores,
+                            LmBatchScratch& scratch);
+
     double get_sent_log_prob(const std::vector<std::string>& words);
 
     // return the max order
@@ -75,6 +122,20 @@ public:
 
     bool has_lexicon() const { return has_lexicon_; }
 
+    // return true if the lexicon states have a language model lookahead, see get_lookahead()
+    bool has_lookahead() const { return !lookahead_.empty(); }
+
+    // return the language model lookahead of a lexicon state: the best loge unigram
+    // probability of the words reachable from it, 0 at the start state of the lexicon
+    float get_lookahead(LexiconFst::StateId state) const { return lookahead_[state]; }
+
+    // return the copy of the lexicon for a NUMA node, made by the first caller of the node so
+    // that its pages are allocated on the node when the caller runs there
+    const LexiconFst* get_lexicon_replica(size_t node);
+
+    // return the time spent in loading the language model and the lexicon
+    const LoadStats& get_load_stats() const { return load_stats_; }
+
     std::unordered_map<std::string, int> get_char_map() { return char_map_; }
 
     std::vector<std::string> get_char_list() { return char_list_; }
@@ -82,9 +143,19 @@ public:
     // reset params alpha & beta
     void reset_params(float alpha, float beta);
 
+    // pre-fault the lexicon and touch the language model, so that the first queries don't
+    // pay for page faults
+    void warmup();
+
     // make ngram for a given prefix
     std::vector<std::string> make_ngram(PathTrie* prefix);
 
+    // make ngram for a given prefix into ngram, reusing its strings and the scratch vectors
+    void make_ngram(PathTrie* prefix,
+                    std::vector<std::string>& ngram,
+                    std::vector<int>& prefix_vec,
+                    std::vector<int>& prefix_steps);
+
     // trransform the labels in index to the vector of words (word based lm) or
     // the vector of characters (character based lm)
     std::vector<std::string> split_labels(const std::vector<int>& labels);
@@ -97,39 +168,100 @@ public:
     // Whether the lm is character based, or bpe based, or word based
     TokenizerType lm_type;
 
-    // pointer to the lexicon of FST
+    // pointer to the lexicon of FST (LexiconFst)
     void* lexicon;
 
 protected:
     // necessary setup: load language model, set char map, fill FST's lexicon
     void setup(const std::string& lm_path,
                const std::vector<std::string>& vocab_list,
-               const std::string& lexicon_fst_path);
+               const std::string& lexicon_fst_path,
+               const std::string& shared_path);
 
-    // load language model from given path
-    void load_lm(const std::string& lm_path);
+    // load language model from given path unless a backend was given, and its vocabulary if
+    // enumerate_vocab is set
+    void load_lm(const std::string& lm_path, bool enumerate_vocab = true);
 
     // fill lexicon for FST
     void load_lexicon(bool add_space, const std::string& lexicon_fst_path);
 
+    // compute the language model lookahead of the lexicon states from the vocabulary
+    void load_lookahead();
+
     // load FST from given path
     void load_lexicon_from_fst_file(const std::string& lexicon_fst_path);
 
+    // write lexicon and vocabulary properties for other processes to attach to
+    void publish_shared_resources(const std::string& shared_path,
+                                  const std::string& lm_path,
+                                  const std::string& lexicon_fst_path);
+
+    // return true if resources published at shared_path were built for the language model at
+    // lm_path, the lexicon FST at lexicon_fst_path and the labels of the scorer
+    bool shared_resources_match(const std::string& shared_path,
+                                const std::string& lm_path,
+                                const std::string& lexicon_fst_path);
+
+    // memory map the lexicon and read the vocabulary properties published by another process
+    void load_shared_resources(const std::string& shared_path);
+
+    // properties of the scorer published along with the shared resources
+    struct SharedMeta {
+        int lm_type = 0;
+        size_t dict_size = 0;
+        bool has_lexicon = false;
+        size_t num_labels = 0;
+        uint64_t labels_hash = 0;
+        size_t lexicon_states = 0;
+        bool has_lookahead = false;
+        uint64_t lm_size = 0;
+        int64_t lm_mtime = 0;
+        // the lexicon FST file, empty when the lexicon is built from the language model
+        uint64_t lexicon_size = 0;
+        int64_t lexicon_mtime = 0;
+        std::string lm_path;
+        std::string lexicon_path;
+    };
+
+    // fill the metadata describing the current scorer built from the language model at lm_path
+    // and the lexicon FST at lexicon_fst_path
+    SharedMeta make_shared_meta(const std::string& lm_path,
+                                const std::string& lexicon_fst_path) const;
+
+    static bool read_shared_meta(const std::string& shared_path, SharedMeta& meta);
+
+    static std::string shared_meta_path(const std::string& shared_path);
+    static std::string shared_lookahead_path(const std::string& shared_path);
+
+    // get the memory region holding the arcs of the lexicon, which is most of its size
+    bool get_lexicon_arcs_region(const void** addr, size_t* length) const;
+
     double get_log_prob(const std::vector<std::string>& words);
 
     // translate the vector in index to string
     std::string vec2str(const std::vector<int>& input);
 
+    void vec2str(const std::vector<int>& input, std::string& word);
+
 private:
-    void* language_model_;
+    LanguageModel* language_model_;
     size_t max_order_;
     size_t dict_size_;
     int SPACE_ID_;
+    util::LoadMethod load_method_;
     bool has_lexicon_;
     std::vector<std::string> char_list_;
     std::unordered_map<std::string, int> char_map_;
 
-    std::vector<std::string> vocabulary_;
+    StringArena vocabulary_;
+    // language model lookahead of each lexicon state, empty without a word lexicon
+    std::vector<float> lookahead_;
+
+    // copies of the lexicon by NUMA node, see get_lexicon_replica()
+    std::vector<std::unique_ptr<LexiconFst>> lexicon_replicas_;
+    std::mutex lexicon_replicas_mutex_;
+
+    LoadStats load_stats_;
 };
 
 #endif // SCORER_H_
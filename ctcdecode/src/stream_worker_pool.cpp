@@ -0,0 +1,252 @@
+#include "stream_worker_pool.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "decoder_utils.h"
+
+// parse a list of cores in the format of sysfs, e.g. "0-3,8-11"
+static std::vector<int> parse_cpu_list(const std::string& cpu_list)
+{
+    std::vector<int> cpus;
+    std::stringstream stream(cpu_list);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// restrict the calling thread to the given cores
+static void pin_current_thread(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &cpu_set);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+        std::cerr << "[StreamWorkerPool] could not pin a worker, it runs on any core\n";
+    }
+#endif
+}
+
+std::vector<std::vector<int>> StreamWorkerPool::get_numa_node_cpus()
+{
+    std::vector<std::vector<int>> node_cpus;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int node = 0;; ++node) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file) {
+            break;
+        }
+        std::string cpu_list;
+        std::getline(file, cpu_list);
+        std::vector<int> cpus;
+        for (int cpu : parse_cpu_list(cpu_list)) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+        if (!cpus.empty()) {
+            node_cpus.push_back(std::move(cpus));
+        }
+    }
+    if (node_cpus.empty()) {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+        node_cpus.push_back(std::move(cpus));
+    }
+#else
+    std::vector<int> cpus(std::max(1u, std::thread::hardware_concurrency()));
+    for (size_t cpu = 0; cpu < cpus.size(); ++cpu) {
+        cpus[cpu] = static_cast<int>(cpu);
+    }
+    node_cpus.push_back(std::move(cpus));
+#endif
+    return node_cpus;
+}
+
+StreamWorkerPool::StreamWorkerPool(size_t num_workers, WorkerPinning pinning)
+    : workers_(num_workers)
+    , worker_cpus_(num_workers)
+    , worker_nodes_(num_workers, 0)
+    , stop_(false)
+    , next_home_(0)
+    , num_stolen_(0)
+{
+    VALID_CHECK_GT(num_workers, 0, "num_workers must be positive!");
+    if (pinning != WorkerPinning::NONE) {
+        // spread the workers round robin over the nodes, so that all the nodes are used
+        // before any of them gets a second worker
+        auto node_cpus = get_numa_node_cpus();
+        for (size_t i = 0; i < num_workers; ++i) {
+            size_t node = i % node_cpus.size();
+            const auto& cpus = node_cpus[node];
+            worker_nodes_[i] = node;
+            if (pinning == WorkerPinning::CORE) {
+                worker_cpus_[i] = { cpus[(i / node_cpus.size()) % cpus.size()] };
+            } else {
+                worker_cpus_[i] = cpus;
+            }
+        }
+    }
+    threads_.reserve(num_workers);
+    for (size_t i = 0; i < num_workers; ++i) {
+        threads_.emplace_back(&StreamWorkerPool::run, this, i);
+    }
+}
+
+StreamWorkerPool::~StreamWorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    condition_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+size_t StreamWorkerPool::assign_home()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_home_++ % workers_.size();
+}
+
+std::future<void>
+StreamWorkerPool::submit(size_t home, std::function<void()> task, TaskPriority priority)
+{
+    VALID_CHECK_LT(home, workers_.size(), "home worker out of range!");
+    std::packaged_task<void()> packaged(std::move(task));
+    std::future<void> result = packaged.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        workers_[home].lanes[static_cast<size_t>(priority)].emplace_back(std::move(packaged));
+    }
+    // the home worker may be busy, in which case an idle worker steals the task
+    condition_.notify_all();
+    return result;
+}
+
+bool StreamWorkerPool::take_task(size_t index,
+                                 TaskPriority lowest_priority,
+                                 std::packaged_task<void()>& task,
+                                 TaskPriority& priority)
+{
+    for (size_t lane = 0; lane <= static_cast<size_t>(lowest_priority); ++lane) {
+        priority = static_cast<TaskPriority>(lane);
+        auto& own_tasks = workers_[index].lanes[lane];
+        if (!own_tasks.empty()) {
+            task = std::move(own_tasks.front());
+            own_tasks.pop_front();
+            return true;
+        }
+        // steal from the back, the task whose home worker would run it last
+        for (size_t offset = 1; offset < workers_.size(); ++offset) {
+            auto& victim = workers_[(index + offset) % workers_.size()];
+            if (victim.busy && !victim.lanes[lane].empty()) {
+                task = std::move(victim.lanes[lane].back());
+                victim.lanes[lane].pop_back();
+                ++num_stolen_;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// pool and index of the worker of the current thread, and the priority of its running task
+static thread_local StreamWorkerPool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+static thread_local TaskPriority current_priority = TaskPriority::HIGH;
+
+void StreamWorkerPool::run(size_t index)
+{
+    if (!worker_cpus_[index].empty()) {
+        pin_current_thread(worker_cpus_[index]);
+    }
+    current_pool = this;
+    current_worker = index;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        std::packaged_task<void()> task;
+        TaskPriority priority;
+        condition_.wait(lock, [&] {
+            return take_task(index, TaskPriority::LOW, task, priority) || stop_;
+        });
+        if (!task.valid()) {
+            return;
+        }
+        workers_[index].busy = true;
+        for (const auto& tasks : workers_[index].lanes) {
+            if (!tasks.empty()) {
+                // the tasks left in the queues can now be stolen
+                condition_.notify_all();
+                break;
+            }
+        }
+        lock.unlock();
+        current_priority = priority;
+        task();
+        lock.lock();
+        workers_[index].busy = false;
+    }
+}
+
+void StreamWorkerPool::yield()
+{
+    if (current_pool == nullptr || current_priority != TaskPriority::LOW) {
+        return;
+    }
+    StreamWorkerPool& pool = *current_pool;
+    std::unique_lock<std::mutex> lock(pool.mutex_);
+    std::packaged_task<void()> task;
+    TaskPriority priority;
+    while (pool.take_task(current_worker, TaskPriority::HIGH, task, priority)) {
+        lock.unlock();
+        current_priority = TaskPriority::HIGH;
+        task();
+        current_priority = TaskPriority::LOW;
+        lock.lock();
+    }
+}
+
+StreamWorkerPool& StreamWorkerPool::shared(size_t num_workers, WorkerPinning pinning)
+{
+    static std::mutex pools_mutex;
+    static std::map<std::pair<size_t, WorkerPinning>, std::unique_ptr<StreamWorkerPool>> pools;
+
+    std::lock_guard<std::mutex> lock(pools_mutex);
+    auto& pool = pools[{ num_workers, pinning }];
+    if (!pool) {
+        pool = std::make_unique<StreamWorkerPool>(num_workers, pinning);
+    }
+    return *pool;
+}
@@ -0,0 +1,102 @@
+#ifndef STREAM_WORKER_POOL_H_
+#define STREAM_WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "decoder_options.h"
+
+// Lanes of the tasks of a StreamWorkerPool, from the most urgent
+enum class TaskPriority : size_t {
+    // latency critical work, e.g. the chunks of live streams
+    HIGH = 0,
+    // bulk work, e.g. offline batches, which yields to the high priority tasks
+    LOW = 1,
+};
+
+/* Persistent workers of the streaming decoders
+ *
+ * Each worker has its own queue of tasks, and each stream is given a home worker which decodes
+ * all of its chunks, so that the trie and the lexicon matcher of the stream stay in the caches of
+ * the same core from one chunk to the next. An idle worker only steals the tasks queued behind
+ * the running task of a busy worker, so that the streams move only when the load is unbalanced.
+ *
+ * The workers can be pinned to cores or NUMA nodes, see WorkerPinning, so that the memory they
+ * allocate for their streams stays on their node.
+ *
+ * The workers serve their high priority tasks before their low priority ones. A running low
+ * priority task can't be interrupted, but it calls yield() between slices of its work, which
+ * runs the waiting high priority tasks on its thread, so that they wait for one slice at most.
+ */
+class StreamWorkerPool {
+public:
+    explicit StreamWorkerPool(size_t num_workers, WorkerPinning pinning = WorkerPinning::NONE);
+    ~StreamWorkerPool();
+
+    StreamWorkerPool(const StreamWorkerPool&) = delete;
+    StreamWorkerPool& operator=(const StreamWorkerPool&) = delete;
+
+    size_t size() const { return workers_.size(); }
+
+    // NUMA node of the cores of a worker, 0 when the workers aren't pinned
+    size_t node_of(size_t worker) const { return worker_nodes_[worker]; }
+
+    // home worker of a new stream, assigned round robin
+    size_t assign_home();
+
+    // queue a task on its home worker, whose future rethrows the exception of the task
+    std::future<void> submit(size_t home,
+                             std::function<void()> task,
+                             TaskPriority priority = TaskPriority::HIGH);
+
+    // run the high priority tasks waiting for the worker of the calling thread, when it runs a
+    // low priority task. Does nothing on other threads
+    static void yield();
+
+    // number of tasks run by another worker than their home
+    size_t num_stolen() const { return num_stolen_; }
+
+    // pool shared by the streaming decodes with the given number of workers and pinning, which
+    // keeps its threads across the decodes
+    static StreamWorkerPool& shared(size_t num_workers,
+                                    WorkerPinning pinning = WorkerPinning::NONE);
+
+    // cores of each NUMA node of the machine, a single node with the cores available to the
+    // process when the topology is unknown
+    static std::vector<std::vector<int>> get_numa_node_cpus();
+
+private:
+    struct Worker {
+        // queues of the tasks by priority
+        std::deque<std::packaged_task<void()>> lanes[2];
+        bool busy = false;
+    };
+
+    void run(size_t index);
+
+    // take the next task of a worker, or steal one, with the mutex held. The tasks of a lane are
+    // taken before those of the next lanes, down to lowest_priority
+    bool take_task(size_t index,
+                   TaskPriority lowest_priority,
+                   std::packaged_task<void()>& task,
+                   TaskPriority& priority);
+
+    std::vector<Worker> workers_;
+    // cores of each worker, empty when it isn't pinned, and their NUMA node
+    std::vector<std::vector<int>> worker_cpus_;
+    std::vector<size_t> worker_nodes_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool stop_;
+    size_t next_home_;
+    std::atomic<size_t> num_stolen_;
+};
+
+#endif // STREAM_WORKER_POOL_H_
@@ -0,0 +1,87 @@
+#ifndef STRING_ARENA_H_
+#define STRING_ARENA_H_
+
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Compact storage for a large number of immutable strings. The characters of all the strings
+ * are stored back to back in a single buffer and each string is addressed through its end
+ * offset, which avoids the per-string allocation and header overhead of std::string.
+ *
+ * Example:
+ *     StringArena arena;
+ *     arena.push_back("WORD1");
+ *     for (std::string_view word : arena) { ... }
+ */
+class StringArena {
+public:
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::string_view*;
+        using reference = std::string_view;
+
+        const_iterator(const StringArena* arena, size_t index)
+            : arena_(arena)
+            , index_(index)
+        {
+        }
+
+        std::string_view operator*() const { return (*arena_)[index_]; }
+
+        const_iterator& operator++()
+        {
+            ++index_;
+            return *this;
+        }
+
+        bool operator==(const const_iterator& other) const { return index_ == other.index_; }
+        bool operator!=(const const_iterator& other) const { return index_ != other.index_; }
+
+    private:
+        const StringArena* arena_;
+        size_t index_;
+    };
+
+    void push_back(std::string_view str)
+    {
+        data_.append(str.data(), str.size());
+        end_offsets_.push_back(data_.size());
+    }
+
+    std::string_view operator[](size_t index) const
+    {
+        size_t begin = index == 0 ? 0 : end_offsets_[index - 1];
+        return std::string_view(data_.data() + begin, end_offsets_[index] - begin);
+    }
+
+    size_t size() const { return end_offsets_.size(); }
+
+    bool empty() const { return end_offsets_.empty(); }
+
+    // return the number of bytes used by the arena
+    size_t memory_size() const
+    {
+        return data_.capacity() + end_offsets_.capacity() * sizeof(size_t);
+    }
+
+    // release all the strings along with their memory
+    void clear()
+    {
+        std::string().swap(data_);
+        std::vector<size_t>().swap(end_offsets_);
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size()); }
+
+private:
+    std::string data_;
+    std::vector<size_t> end_offsets_;
+};
+
+#endif // STRING_ARENA_H_
@@ -0,0 +1,46 @@
+#include "unigram_model.h"
+
+#include <cstring>
+
+#include "decoder_utils.h"
+
+UnigramModel::UnigramModel(const std::vector<std::string>& words,
+                           const std::vector<float>& log10_probs)
+{
+    VALID_CHECK_EQ(words.size(), log10_probs.size(), "Each word must have one probability");
+    for (size_t i = 0; i < words.size(); ++i) {
+        log_probs_[words[i]] = log10_probs[i] / NUM_FLT_LOGE;
+    }
+}
+
+LmState UnigramModel::null_context_state() const
+{
+    LmState state;
+    std::memset(&state, 0, sizeof(state));
+    return state;
+}
+
+void UnigramModel::score(const std::vector<LmState>& states,
+                         const std::vector<std::string_view>& tokens,
+                         std::vector<float>& scores,
+                         std::vector<LmState>& new_states) const
+{
+    scores.resize(tokens.size());
+    new_states.assign(tokens.size(), null_context_state());
+    // the lookup key is kept per thread, as the model is shared, so that it keeps its capacity
+    static thread_local std::string word;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        word.assign(tokens[i].data(), tokens[i].size());
+        auto it = log_probs_.find(word);
+        scores[i] = (it == log_probs_.end()) ? OOV_SCORE : it->second;
+    }
+}
+
+StringArena UnigramModel::take_vocabulary()
+{
+    StringArena vocabulary;
+    for (const auto& entry : log_probs_) {
+        vocabulary.push_back(entry.first);
+    }
+    return vocabulary;
+}
@@ -0,0 +1,36 @@
+#ifndef UNIGRAM_MODEL_H_
+#define UNIGRAM_MODEL_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "language_model.h"
+
+/* In-process unigram language model, built from the log10 probabilities of its words like the
+ * 1-grams of an ARPA file. It keeps no context, every state is the null context state.
+ *
+ * It is a minimal LanguageModel backend, for tests and for plugging a custom word list into
+ * the decoder without building a KenLM model.
+ */
+class UnigramModel : public LanguageModel {
+public:
+    UnigramModel(const std::vector<std::string>& words, const std::vector<float>& log10_probs);
+
+    size_t order() const override { return 1; }
+
+    LmState null_context_state() const override;
+
+    void score(const std::vector<LmState>& states,
+               const std::vector<std::string_view>& tokens,
+               std::vector<float>& scores,
+               std::vector<LmState>& new_states) const override;
+
+    StringArena take_vocabulary() override;
+
+private:
+    // loge probability of each word
+    std::unordered_map<std::string, float> log_probs_;
+};
+
+#endif // UNIGRAM_MODEL_H_
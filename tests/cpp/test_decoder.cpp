@@ -0,0 +1,725 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include "ctc_beam_search_decoder.h"
+#include "decoder_options.h"
+#include "decoder_utils.h"
+#include "scorer.h"
+#include "stream_worker_pool.h"
+#include "unigram_model.h"
+
+// random frames whose probabilities sum to 1, with one dominant token per frame
+static std::vector<std::vector<double>>
+make_random_frames(size_t num_frames, size_t vocab_size, unsigned seed)
+{
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> noise(0.0, 1.0);
+    std::uniform_int_distribution<size_t> token(0, vocab_size - 1);
+    std::vector<std::vector<double>> frames(num_frames, std::vector<double>(vocab_size));
+    for (auto& frame : frames) {
+        double sum = 0.0;
+        for (auto& prob : frame) {
+            prob = noise(generator);
+        }
+        frame[token(generator)] += 4.0;
+        for (auto prob : frame) {
+            sum += prob;
+        }
+        for (auto& prob : frame) {
+            prob /= sum;
+        }
+    }
+    return frames;
+}
+
+static std::vector<std::pair<double, Output>>
+decode(DecoderOptions& options, const std::vector<std::vector<double>>& frames)
+{
+    DecoderState state(&options, nullptr, nullptr);
+    state.next(frames);
+    return state.decode();
+}
+
+static void expect_same_results(const std::vector<std::pair<double, Output>>& results,
+                                const std::vector<std::pair<double, Output>>& expected)
+{
+    ASSERT_EQ(results.size(), expected.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        EXPECT_FLOAT_EQ(results[i].first, expected[i].first);
+        EXPECT_EQ(results[i].second.tokens, expected[i].second.tokens);
+        EXPECT_EQ(results[i].second.timesteps, expected[i].second.timesteps);
+    }
+}
+
+static const std::vector<std::string> VOCAB = { "_", "a", "b", "c", "d", "e", " ", "'" };
+
+TEST(DecoderTest, TestPipelinedPruningMatchesSerial)
+{
+    DecoderOptions options(VOCAB, 5, 1.0, 8, 1, 0, false, false, -5.0, '#');
+    auto frames = make_random_frames(300, VOCAB.size(), 1);
+    auto expected = decode(options, frames);
+
+    options.num_prune_threads = 3;
+    expect_same_results(decode(options, frames), expected);
+
+    // in a stream, chunks shorter than a pruning chunk are pruned serially
+    DecoderState state(&options, nullptr, nullptr);
+    state.next(std::vector<std::vector<double>>(frames.begin(), frames.begin() + 10));
+    state.next(std::vector<std::vector<double>>(frames.begin() + 10, frames.end()));
+    expect_same_results(state.decode(), expected);
+}
+
+TEST(DecoderTest, TestAdaptiveCutoffFollowsEntropy)
+{
+    // a confident frame keeps the lower bound, a uniform frame the upper bound
+    std::vector<double> confident = { 0.97, 0.01, 0.01, 0.01 };
+    std::vector<double> uniform(8, 1.0 / 8);
+    EXPECT_EQ(get_adaptive_cutoff_top_n(confident, false, 1, 40, 1.0), 2u);
+    EXPECT_EQ(get_adaptive_cutoff_top_n(confident, false, 3, 40, 1.0), 3u);
+    EXPECT_EQ(get_adaptive_cutoff_top_n(uniform, false, 1, 40, 2.0), 16u);
+    EXPECT_EQ(get_adaptive_cutoff_top_n(uniform, false, 1, 6, 2.0), 6u);
+
+    std::vector<double> log_uniform(8, std::log(1.0 / 8));
+    EXPECT_EQ(get_adaptive_cutoff_top_n(log_uniform, true, 1, 40, 1.0), 8u);
+
+    std::vector<std::pair<int, double>> prob_idx;
+    std::vector<std::pair<size_t, float>> log_prob_idx;
+    get_pruned_log_probs(confident, 1.0, 40, false, prob_idx, log_prob_idx, 1, 1.0);
+    ASSERT_EQ(log_prob_idx.size(), 2u);
+    EXPECT_EQ(log_prob_idx[0].first, 0u);
+}
+
+TEST(DecoderTest, TestAdaptiveCutoffKeepsConfidentBeams)
+{
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 1, 0, false, false, -5.0, '#');
+    auto frames = make_random_frames(100, VOCAB.size(), 2);
+    auto expected = decode(options, frames);
+
+    options.min_cutoff_top_n = 2;
+    auto results = decode(options, frames);
+    ASSERT_FALSE(results.empty());
+    EXPECT_EQ(results[0].second.tokens, expected[0].second.tokens);
+}
+
+TEST(DecoderTest, TestGreedyMarginOnConfidentFrames)
+{
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 1, 0, false, false, -5.0, '#');
+    auto frames = make_random_frames(100, VOCAB.size(), 3);
+    auto expected = decode(options, frames);
+
+    // no frame is confident enough, the full beam search runs everywhere
+    options.greedy_margin = 1.0;
+    expect_same_results(decode(options, frames), expected);
+
+    // every frame is confident: the best path is the collapsed argmax path
+    options.greedy_margin = 1e-9;
+    std::vector<int> greedy_tokens;
+    size_t previous = options.blank_id;
+    for (const auto& frame : frames) {
+        size_t argmax;
+        get_argmax_margin(frame, false, argmax);
+        if (argmax != options.blank_id && argmax != previous) {
+            greedy_tokens.push_back(static_cast<int>(argmax));
+        }
+        previous = argmax;
+    }
+    auto results = decode(options, frames);
+    ASSERT_FALSE(results.empty());
+    EXPECT_EQ(results[0].second.tokens, greedy_tokens);
+}
+
+TEST(DecoderTest, TestLongFormSegmentsAtPauses)
+{
+    // speech, a pause of 20 confident blanks, speech, a pause too short to cut, speech
+    auto frames = make_random_frames(90, VOCAB.size(), 4);
+    std::vector<double> blank(VOCAB.size(), 0.0);
+    blank[0] = 1.0;
+    std::fill(frames.begin() + 30, frames.begin() + 50, blank);
+    std::fill(frames.begin() + 70, frames.begin() + 73, blank);
+
+    auto segments = get_blank_segments(frames, 0, false, 0.999, 10);
+    ASSERT_EQ(segments.size(), 2u);
+    EXPECT_EQ(segments[0], std::make_pair(size_t(0), size_t(40)));
+    EXPECT_EQ(segments[1], std::make_pair(size_t(40), size_t(90)));
+
+    // the stitched result has the tokens of the whole decode at the same timesteps
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 2, 0, false, false, -5.0, '#');
+    auto expected = ctc_beam_search_decoder_batch({ frames }, &options);
+    options.segment_min_pause = 10;
+    options.segment_context_frames = 15;
+    auto results = ctc_beam_search_decoder_batch({ frames }, &options);
+    ASSERT_EQ(results.size(), 1u);
+    ASSERT_EQ(results[0].size(), 1u);
+    EXPECT_EQ(results[0][0].second.tokens, expected[0][0].second.tokens);
+    EXPECT_EQ(results[0][0].second.timesteps, expected[0][0].second.timesteps);
+}
+
+TEST(DecoderTest, TestLongFormCarriesContext)
+{
+    // noisy frames spelling words, with blanks between the letters and a pause between two of
+    // the words
+    auto frames = make_random_frames(120, VOCAB.size(), 41);
+    const std::string text = "ab cd e bad ab e cd ";
+    for (size_t i = 0; i < frames.size(); ++i) {
+        char letter = text[(i / 2) % text.size()];
+        size_t token = i % 2 == 1 ? 0 : letter == ' ' ? 6 : letter - 'a' + 1;
+        frames[i][token] += 1000.0;
+        for (auto& prob : frames[i]) {
+            prob /= 1001.0;
+        }
+    }
+    std::vector<double> blank(VOCAB.size(), 0.0);
+    blank[0] = 1.0;
+    std::fill(frames.begin() + 40, frames.begin() + 80, blank);
+    std::vector<float> log10_probs = { -1.0, -1.5, -2.0, -2.5, -1.2, -1.0 };
+    Scorer word_scorer(0.5,
+                       1.0,
+                       new UnigramModel({ "ab", "cd", "e", "bad", "ace", "ca" }, log10_probs),
+                       VOCAB,
+                       "word",
+                       "");
+    Scorer char_scorer(0.5,
+                       1.0,
+                       new UnigramModel({ "a", "b", "c", "d", "e", " " }, log10_probs),
+                       VOCAB,
+                       "character",
+                       "");
+
+    // the stitched result has the tokens of the whole decode at the same timesteps
+    for (Scorer* ext_scorer : { &word_scorer, &char_scorer }) {
+        SCOPED_TRACE(ext_scorer->is_word_based() ? "word" : "character");
+        DecoderOptions options(VOCAB, 8, 1.0, 8, 2, 0, false, false, -5.0, '#');
+        auto expected = ctc_beam_search_decoder_batch({ frames }, &options, ext_scorer);
+        options.segment_min_pause = 10;
+        options.segment_carry_context = true;
+        auto results = ctc_beam_search_decoder_batch({ frames }, &options, ext_scorer);
+        ASSERT_EQ(results.size(), 1u);
+        ASSERT_EQ(results[0].size(), 1u);
+        EXPECT_EQ(results[0][0].second.tokens, expected[0][0].second.tokens);
+        EXPECT_EQ(results[0][0].second.timesteps, expected[0][0].second.timesteps);
+
+        options.segment_context_frames = 15;
+        EXPECT_THROW(ctc_beam_search_decoder_batch({ frames }, &options, ext_scorer),
+                     std::runtime_error);
+    }
+}
+
+TEST(DecoderTest, TestLongFormThrowsOnceAllSegmentsAreDone)
+{
+    std::vector<double> blank(VOCAB.size(), 0.0);
+    blank[0] = 1.0;
+    std::vector<std::vector<std::vector<double>>> batch;
+    for (unsigned i = 0; i < 3; ++i) {
+        batch.push_back(make_random_frames(90, VOCAB.size(), 70 + i));
+        std::fill(batch.back().begin() + 30, batch.back().begin() + 50, blank);
+    }
+    // the last segment of the first sequence doesn't match the vocabulary
+    batch[0][80].pop_back();
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 2, 0, false, false, -5.0, '#');
+    options.segment_min_pause = 10;
+    for (bool carry_context : { false, true }) {
+        options.segment_carry_context = carry_context;
+        EXPECT_THROW(ctc_beam_search_decoder_batch(batch, &options), std::runtime_error);
+    }
+}
+
+TEST(DecoderTest, TestScorerThrowsOnMissingLexiconFile)
+{
+    // the lexicon is read on a loader thread, whose failure reaches the constructor
+    std::vector<std::string> words = { "ab", "cd" };
+    std::vector<float> log10_probs = { -1.0, -1.5 };
+    EXPECT_THROW(Scorer(0.5,
+                        1.0,
+                        new UnigramModel(words, log10_probs),
+                        VOCAB,
+                        "word",
+                        "/nonexistent/lexicon.fst"),
+                 std::runtime_error);
+}
+
+TEST(DecoderTest, TestScorerKeepsLexiconReadFromFile)
+{
+    // the lexicon spells "ab" and "cd", with the labels shifted by one for the epsilon
+    fst::StdVectorFst lexicon;
+    add_word_to_fst({ 2, 3 }, &lexicon);
+    add_word_to_fst({ 4, 5 }, &lexicon);
+    std::string lexicon_fst_path = testing::TempDir() + "test_decoder_lexicon.fst";
+    ASSERT_TRUE(lexicon.Write(lexicon_fst_path));
+
+    std::vector<std::string> words = { "ab", "cd" };
+    std::vector<float> log10_probs = { -1.0, -1.5 };
+    Scorer scorer(0.5, 1.0, new UnigramModel(words, log10_probs), VOCAB, "word", lexicon_fst_path);
+    EXPECT_TRUE(scorer.has_lexicon());
+    std::remove(lexicon_fst_path.c_str());
+}
+
+TEST(DecoderTest, TestLockstepBatchMatchesBatch)
+{
+    std::vector<std::vector<std::vector<double>>> batch;
+    for (unsigned i = 0; i < 7; ++i) {
+        batch.push_back(make_random_frames(20 + 13 * i, VOCAB.size(), 10 + i));
+    }
+    std::vector<std::string> words = { "ab", "cd", "e", "bad", "ace" };
+    std::vector<float> log10_probs = { -1.0, -1.5, -2.0, -2.5, -1.2 };
+    Scorer scorer(0.5, 1.0, new UnigramModel(words, log10_probs), VOCAB, "word", "");
+
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 3, 0, false, false, -5.0, '#');
+    for (Scorer* ext_scorer : { static_cast<Scorer*>(nullptr), &scorer }) {
+        options.lockstep_batch = false;
+        auto expected = ctc_beam_search_decoder_batch(batch, &options, ext_scorer);
+        options.lockstep_batch = true;
+        auto results = ctc_beam_search_decoder_batch(batch, &options, ext_scorer);
+        ASSERT_EQ(results.size(), expected.size());
+        for (size_t i = 0; i < results.size(); ++i) {
+            expect_same_results(results[i], expected[i]);
+        }
+    }
+}
+
+TEST(DecoderTest, TestLockstepMatchesNext)
+{
+    std::vector<std::vector<std::vector<double>>> batch;
+    for (unsigned i = 0; i < 4; ++i) {
+        batch.push_back(make_random_frames(30 + 11 * i, VOCAB.size(), 20 + i));
+    }
+    // greedy frames and the node budget give the beams of the states different widths
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 1, 0, false, false, -5.0, '#');
+    options.greedy_margin = 0.2;
+    options.max_trie_nodes = 40;
+    options.commit_prefix = true;
+
+    std::vector<std::unique_ptr<DecoderState>> states;
+    std::vector<DecoderState*> lockstep_states;
+    std::vector<const std::vector<std::vector<double>>*> probs_seqs;
+    for (const auto& frames : batch) {
+        states.emplace_back(new DecoderState(&options, nullptr, nullptr));
+        lockstep_states.push_back(states.back().get());
+        probs_seqs.push_back(&frames);
+    }
+    DecoderState::next_lockstep(lockstep_states, probs_seqs);
+    for (size_t i = 0; i < batch.size(); ++i) {
+        DecoderState state(&options, nullptr, nullptr);
+        state.next(batch[i]);
+        expect_same_results(states[i]->decode(), state.decode());
+    }
+}
+
+TEST(DecoderTest, TestLockstepThrowsOnceAllSharesAreDone)
+{
+    std::vector<std::vector<std::vector<double>>> batch;
+    for (unsigned i = 0; i < 6; ++i) {
+        batch.push_back(make_random_frames(30, VOCAB.size(), 80 + i));
+    }
+    batch[0][0].pop_back();
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 3, 0, false, false, -5.0, '#');
+    options.lockstep_batch = true;
+    EXPECT_THROW(ctc_beam_search_decoder_batch(batch, &options), std::runtime_error);
+}
+
+TEST(DecoderTest, TestLockstepMeetsTheDeadline)
+{
+    std::vector<std::vector<std::vector<double>>> batch;
+    for (unsigned i = 0; i < 4; ++i) {
+        batch.push_back(make_random_frames(30, VOCAB.size(), 30 + i));
+    }
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 2, 0, false, false, -5.0, '#');
+    options.lockstep_batch = true;
+    options.deadline_ms = 1e-6;
+    auto results = ctc_beam_search_decoder_batch(batch, &options);
+    ASSERT_EQ(results.size(), batch.size());
+    for (const auto& result : results) {
+        ASSERT_FALSE(result.empty());
+        EXPECT_TRUE(result[0].second.degraded);
+    }
+}
+
+TEST(DecoderTest, TestBatchRejectsConflictingEngines)
+{
+    std::vector<std::vector<std::vector<double>>> batch
+        = { make_random_frames(20, VOCAB.size(), 40) };
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 1, 0, false, false, -5.0, '#');
+    options.lockstep_batch = true;
+    options.segment_min_pause = 10;
+    EXPECT_THROW(ctc_beam_search_decoder_batch(batch, &options), std::runtime_error);
+    options.segment_min_pause = 0;
+    options.offline_priority = true;
+    EXPECT_THROW(ctc_beam_search_decoder_batch(batch, &options), std::runtime_error);
+}
+
+TEST(DecoderTest, TestStreamWorkerPoolRunsOnHomeWorker)
+{
+    StreamWorkerPool pool(3);
+    std::vector<std::thread::id> thread_ids(6);
+    for (size_t i = 0; i < thread_ids.size(); ++i) {
+        pool.submit(i % 3, [&, i]() { thread_ids[i] = std::this_thread::get_id(); }).get();
+    }
+    for (size_t i = 3; i < thread_ids.size(); ++i) {
+        EXPECT_EQ(thread_ids[i], thread_ids[i - 3]);
+    }
+    EXPECT_NE(thread_ids[0], thread_ids[1]);
+    EXPECT_EQ(pool.num_stolen(), 0u);
+}
+
+TEST(DecoderTest, TestStreamWorkerPoolStealsFromBusyWorker)
+{
+    StreamWorkerPool pool(2);
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    auto blocking = pool.submit(0, [released]() { released.wait(); });
+    // queued behind the blocked task, so the idle worker steals it
+    auto queued = pool.submit(0, []() {});
+    queued.get();
+    EXPECT_EQ(pool.num_stolen(), 1u);
+    release.set_value();
+    blocking.get();
+}
+
+TEST(DecoderTest, TestStreamWorkerPoolSpreadsPinnedWorkersOverNodes)
+{
+    size_t num_nodes = StreamWorkerPool::get_numa_node_cpus().size();
+    ASSERT_GT(num_nodes, 0u);
+    for (auto pinning : { WorkerPinning::CORE, WorkerPinning::NUMA_NODE }) {
+        StreamWorkerPool pool(4, pinning);
+        for (size_t i = 0; i < pool.size(); ++i) {
+            EXPECT_EQ(pool.node_of(i), i % num_nodes);
+            bool ran = false;
+            pool.submit(i, [&]() { ran = true; }).get();
+            EXPECT_TRUE(ran);
+        }
+    }
+}
+
+TEST(DecoderTest, TestStreamWorkerPoolRunsHighPriorityFirst)
+{
+    StreamWorkerPool pool(1);
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    auto blocking = pool.submit(0, [released]() { released.wait(); });
+    std::vector<TaskPriority> order;
+    auto low = pool.submit(0, [&]() { order.push_back(TaskPriority::LOW); }, TaskPriority::LOW);
+    auto high = pool.submit(0, [&]() { order.push_back(TaskPriority::HIGH); });
+    release.set_value();
+    low.get();
+    high.get();
+    EXPECT_EQ(order, std::vector<TaskPriority>({ TaskPriority::HIGH, TaskPriority::LOW }));
+}
+
+TEST(DecoderTest, TestStreamWorkerPoolLowPriorityTaskYields)
+{
+    StreamWorkerPool pool(1);
+    std::promise<void> submitted;
+    std::shared_future<void> high_submitted = submitted.get_future().share();
+    bool high_ran = false;
+    bool ran_in_yield = false;
+    auto low = pool.submit(
+        0,
+        [&]() {
+            high_submitted.wait();
+            StreamWorkerPool::yield();
+            ran_in_yield = high_ran;
+        },
+        TaskPriority::LOW);
+    auto high = pool.submit(0, [&]() { high_ran = true; });
+    submitted.set_value();
+    low.get();
+    high.get();
+    EXPECT_TRUE(ran_in_yield);
+}
+
+TEST(DecoderTest, TestOfflinePriorityBatchMatchesBatch)
+{
+    std::vector<std::vector<std::vector<double>>> batch;
+    for (unsigned i = 0; i < 5; ++i) {
+        batch.push_back(make_random_frames(60, VOCAB.size(), 50 + i));
+    }
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 2, 0, false, false, -5.0, '#');
+    auto expected = ctc_beam_search_decoder_batch(batch, &options);
+    options.offline_priority = true;
+    options.preemption_frames = 7;
+    auto results = ctc_beam_search_decoder_batch(batch, &options);
+    ASSERT_EQ(results.size(), expected.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        expect_same_results(results[i], expected[i]);
+    }
+}
+
+TEST(DecoderTest, TestOfflinePriorityBatchThrowsOnceAllUtterancesAreDone)
+{
+    std::vector<std::vector<std::vector<double>>> batch;
+    for (unsigned i = 0; i < 4; ++i) {
+        batch.push_back(make_random_frames(40, VOCAB.size(), 60 + i));
+    }
+    batch[0][0].pop_back();
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 2, 0, false, false, -5.0, '#');
+    options.offline_priority = true;
+    EXPECT_THROW(ctc_beam_search_decoder_batch(batch, &options), std::runtime_error);
+    // the shared workers are still usable
+    batch[0] = batch[1];
+    EXPECT_EQ(ctc_beam_search_decoder_batch(batch, &options).size(), batch.size());
+}
+
+TEST(DecoderTest, TestDeadlineKeepsResultsWhenMet)
+{
+    auto frames = make_random_frames(60, VOCAB.size(), 70);
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 1, 0, false, false, -5.0, '#');
+    auto expected = ctc_beam_search_decoder(frames, &options);
+    options.deadline_ms = 60000.0;
+    auto results = ctc_beam_search_decoder(frames, &options);
+    expect_same_results(results, expected);
+    ASSERT_FALSE(results.empty());
+    EXPECT_FALSE(results[0].second.degraded);
+}
+
+TEST(DecoderTest, TestDeadlineReturnsDegradedResultsWhenMissed)
+{
+    auto frames = make_random_frames(60, VOCAB.size(), 71);
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 1, 0, false, false, -5.0, '#');
+    options.deadline_ms = 1e-6;
+    DecoderState state(&options, nullptr, nullptr);
+    state.next(frames);
+    // the frames past the deadline are skipped, but keep their place in the timesteps
+    state.next(frames);
+    auto results = state.decode();
+    ASSERT_FALSE(results.empty());
+    EXPECT_TRUE(results[0].second.degraded);
+    for (int timestep : results[0].second.timesteps) {
+        EXPECT_TRUE(timestep < 60 || timestep >= 120);
+    }
+}
+
+TEST(DecoderTest, TestPipelinedDecodingMeetsTheDeadline)
+{
+    auto frames = make_random_frames(60, VOCAB.size(), 72);
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 1, 0, false, false, -5.0, '#');
+    options.num_prune_threads = 2;
+    auto expected = ctc_beam_search_decoder(frames, &options);
+    options.deadline_ms = 60000.0;
+    auto results = ctc_beam_search_decoder(frames, &options);
+    expect_same_results(results, expected);
+    ASSERT_FALSE(results.empty());
+    EXPECT_FALSE(results[0].second.degraded);
+
+    options.deadline_ms = 1e-6;
+    results = ctc_beam_search_decoder(frames, &options);
+    ASSERT_FALSE(results.empty());
+    EXPECT_TRUE(results[0].second.degraded);
+}
+
+TEST(DecoderTest, TestDeadlineScope)
+{
+    auto frames = make_random_frames(60, VOCAB.size(), 73);
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 1, 0, false, false, -5.0, '#');
+
+    // the budget of each chunk restarts, and so does the degraded flag
+    DecoderState chunk_state(&options, nullptr, nullptr);
+    options.deadline_ms = 1e-6;
+    chunk_state.next(frames);
+    options.deadline_ms = 60000.0;
+    chunk_state.next(frames);
+    auto results = chunk_state.decode();
+    ASSERT_FALSE(results.empty());
+    EXPECT_FALSE(results[0].second.degraded);
+
+    // the budget of the stream has passed for all its later chunks
+    options.deadline_scope = DeadlineScope::STREAM;
+    DecoderState stream_state(&options, nullptr, nullptr);
+    options.deadline_ms = 1e-6;
+    stream_state.next(frames);
+    options.deadline_ms = 60000.0;
+    stream_state.next(frames);
+    results = stream_state.decode();
+    ASSERT_FALSE(results.empty());
+    EXPECT_TRUE(results[0].second.degraded);
+    for (int timestep : results[0].second.timesteps) {
+        EXPECT_LT(timestep, 60);
+    }
+}
+
+TEST(DecoderTest, TestTrieNodeBudgetBoundsTheTrie)
+{
+    // near uniform frames, which keep many prefixes apart
+    std::vector<std::vector<double>> frames(80, std::vector<double>(VOCAB.size()));
+    std::mt19937 generator(80);
+    std::uniform_real_distribution<double> noise(0.9, 1.1);
+    for (auto& frame : frames) {
+        double sum = 0.0;
+        for (auto& prob : frame) {
+            prob = noise(generator);
+            sum += prob;
+        }
+        for (auto& prob : frame) {
+            prob /= sum;
+        }
+    }
+
+    DecoderOptions options(VOCAB, 8, 1.0, 64, 1, 0, false, false, -5.0, '#');
+    DecoderState unbounded(&options, nullptr, nullptr);
+    unbounded.next(frames);
+    ASSERT_GT(unbounded.num_trie_nodes(), 60u);
+
+    options.max_trie_nodes = 60;
+    DecoderState bounded(&options, nullptr, nullptr);
+    bounded.next(frames);
+    EXPECT_LE(bounded.num_trie_nodes(), 60u);
+    EXPECT_LT(bounded.num_allocated_trie_nodes(), unbounded.num_allocated_trie_nodes());
+    EXPECT_FALSE(bounded.decode().empty());
+}
+
+TEST(DecoderTest, TestCommitPrefixKeepsResults)
+{
+    // noisy frames spelling words of the language model, with blanks between the letters
+    auto frames = make_random_frames(400, VOCAB.size(), 50);
+    const std::string text = "ab cd ace e bad ab e cd ";
+    for (size_t i = 0; i < frames.size(); ++i) {
+        char letter = text[(i / 2) % text.size()];
+        size_t token = i % 2 == 1 ? 0 : letter == ' ' ? 6 : letter - 'a' + 1;
+        frames[i][token] += 2.0;
+        for (auto& prob : frames[i]) {
+            prob /= 3.0;
+        }
+    }
+    std::vector<std::string> words = { "ab", "cd", "e", "bad", "ace" };
+    std::vector<float> log10_probs = { -1.0, -1.5, -2.0, -2.5, -1.2 };
+    Scorer scorer(0.5, 1.0, new UnigramModel(words, log10_probs), VOCAB, "word", "");
+
+    DecoderOptions options(VOCAB, 8, 1.0, 4, 1, 0, false, false, -5.0, '#');
+    DecoderOptions commit_options = options;
+    commit_options.commit_prefix = true;
+    for (Scorer* ext_scorer : { static_cast<Scorer*>(nullptr), &scorer }) {
+        DecoderState state(&options, ext_scorer, nullptr);
+        DecoderState committing(&commit_options, ext_scorer, nullptr);
+        DecoderState taking(&commit_options, ext_scorer, nullptr);
+        Output taken;
+        for (size_t begin = 0; begin < frames.size(); begin += 20) {
+            std::vector<std::vector<double>> chunk(frames.begin() + begin,
+                                                   frames.begin() + begin + 20);
+            state.next(chunk);
+            committing.next(chunk);
+            taking.next(chunk);
+            Output committed = taking.take_committed();
+            taken.tokens.insert(
+                taken.tokens.end(), committed.tokens.begin(), committed.tokens.end());
+        }
+        EXPECT_LT(committing.num_trie_nodes(), state.num_trie_nodes());
+
+        auto expected = state.decode();
+        auto results = committing.decode();
+        if (ext_scorer == nullptr) {
+            expect_same_results(results, expected);
+        }
+        ASSERT_EQ(results.size(), expected.size());
+        for (size_t i = 0; i < results.size(); ++i) {
+            EXPECT_EQ(results[i].second.tokens, expected[i].second.tokens);
+            EXPECT_EQ(results[i].second.timesteps, expected[i].second.timesteps);
+        }
+
+        // the taken tokens are left out of the results
+        ASSERT_FALSE(taken.tokens.empty());
+        auto best = taking.decode()[0].second.tokens;
+        best.insert(best.begin(), taken.tokens.begin(), taken.tokens.end());
+        EXPECT_EQ(best, expected[0].second.tokens);
+    }
+}
+
+TEST(DecoderTest, TestBestPartialIsTheBestResult)
+{
+    auto frames = make_random_frames(120, VOCAB.size(), 50);
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 1, 0, false, false, -5.0, '#');
+    for (bool commit_prefix : { false, true }) {
+        options.commit_prefix = commit_prefix;
+        DecoderState state(&options, nullptr, nullptr);
+        EXPECT_TRUE(state.best_partial().second.tokens.empty());
+        for (size_t begin = 0; begin < frames.size(); begin += 30) {
+            state.next(std::vector<std::vector<double>>(frames.begin() + begin,
+                                                        frames.begin() + begin + 30));
+            // without a language model, the best prefix is the best result
+            auto results = state.decode();
+            auto partial = state.best_partial();
+            ASSERT_FALSE(results.empty());
+            EXPECT_EQ(partial.second.tokens, results[0].second.tokens);
+            EXPECT_EQ(partial.second.timesteps, results[0].second.timesteps);
+        }
+    }
+}
+
+TEST(DecoderTest, TestBatchWithStatesMatchesSingleStream)
+{
+    std::vector<std::vector<std::vector<double>>> streams;
+    for (unsigned i = 0; i < 5; ++i) {
+        streams.push_back(make_random_frames(40, VOCAB.size(), 30 + i));
+    }
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 2, 0, false, false, -5.0, '#');
+    std::vector<std::unique_ptr<DecoderState>> states;
+    std::vector<void*> state_ptrs;
+    for (size_t i = 0; i < streams.size(); ++i) {
+        states.push_back(std::make_unique<DecoderState>(&options, nullptr, nullptr));
+        state_ptrs.push_back(states.back().get());
+    }
+
+    // feed the streams in chunks of 10 frames
+    std::vector<std::vector<std::pair<double, Output>>> results;
+    for (size_t begin = 0; begin < 40; begin += 10) {
+        std::vector<std::vector<std::vector<double>>> chunks;
+        for (const auto& frames : streams) {
+            chunks.emplace_back(frames.begin() + begin, frames.begin() + begin + 10);
+        }
+        std::vector<bool> is_eos(streams.size(), begin + 10 == 40);
+        results = ctc_beam_search_decoder_batch_with_states(chunks, 3, state_ptrs, is_eos);
+    }
+    for (size_t i = 0; i < streams.size(); ++i) {
+        EXPECT_LT(states[i]->home_worker, 3u);
+        expect_same_results(results[i], ctc_beam_search_decoder(streams[i], &options));
+    }
+}
+
+TEST(DecoderTest, TestBatchWithStatesThrowsOnceAllStreamsAreDone)
+{
+    std::vector<std::vector<std::vector<double>>> chunks;
+    for (unsigned i = 0; i < 4; ++i) {
+        chunks.push_back(make_random_frames(40, VOCAB.size(), 50 + i));
+    }
+    // the frames of the first stream don't match the vocabulary
+    chunks[0][0].pop_back();
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 2, 0, false, false, -5.0, '#');
+    std::vector<std::unique_ptr<DecoderState>> states;
+    std::vector<void*> state_ptrs;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        states.push_back(std::make_unique<DecoderState>(&options, nullptr, nullptr));
+        state_ptrs.push_back(states.back().get());
+    }
+    std::vector<bool> is_eos(chunks.size(), true);
+    EXPECT_THROW(ctc_beam_search_decoder_batch_with_states(chunks, 2, state_ptrs, is_eos),
+                 std::runtime_error);
+    // the other streams were decoded before the exception left the batch
+    for (size_t i = 1; i < states.size(); ++i) {
+        EXPECT_GT(states[i]->num_trie_nodes(), 0u);
+    }
+}
+
+TEST(DecoderTest, TestBatchWithStatesRejectsMixedPlacements)
+{
+    std::vector<std::vector<std::vector<double>>> chunks(
+        2, make_random_frames(10, VOCAB.size(), 40));
+    DecoderOptions options(VOCAB, 8, 1.0, 8, 2, 0, false, false, -5.0, '#');
+    DecoderOptions pinned_options = options;
+    pinned_options.worker_pinning = WorkerPinning::CORE;
+    DecoderState state(&options, nullptr, nullptr);
+    DecoderState pinned_state(&pinned_options, nullptr, nullptr);
+    std::vector<void*> state_ptrs = { &state, &pinned_state };
+    std::vector<bool> is_eos(2, true);
+    EXPECT_THROW(ctc_beam_search_decoder_batch_with_states(chunks, 2, state_ptrs, is_eos),
+                 std::runtime_error);
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
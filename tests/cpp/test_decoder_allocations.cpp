@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+#include "ctc_beam_search_decoder.h"
+#include "decoder_options.h"
+#include "decoder_utils.h"
+#include "scorer.h"
+#include "unigram_model.h"
+
+// count the heap allocations made while counting is enabled
+static std::atomic<bool> count_allocations(false);
+static std::atomic<size_t> num_allocations(0);
+
+void* operator new(size_t size)
+{
+    if (count_allocations) {
+        ++num_allocations;
+    }
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+static size_t count_allocations_of(const std::function<void()>& function)
+{
+    num_allocations = 0;
+    count_allocations = true;
+    function();
+    count_allocations = false;
+    return num_allocations;
+}
+
+// frames where the blank dominates: the beam holds the empty prefix and the single token
+// prefixes, and the longer candidates are created and pruned again at every frame
+static std::vector<std::vector<double>> make_blank_frames(size_t num_frames, size_t vocab_size)
+{
+    std::vector<double> frame(vocab_size, 1e-6);
+    frame[0] = 1.0 - 1e-6 * (vocab_size - 1);
+    return std::vector<std::vector<double>>(num_frames, frame);
+}
+
+TEST(DecoderAllocationsTest, TestPrunedLogProbsReuseScratch)
+{
+    std::vector<double> frame = { 0.5, 0.2, 0.1, 0.1, 0.1 };
+    std::vector<std::pair<int, double>> prob_idx;
+    std::vector<std::pair<size_t, float>> log_prob_idx;
+    get_pruned_log_probs(frame, 1.0, 3, false, prob_idx, log_prob_idx);
+    EXPECT_EQ(log_prob_idx.size(), 3u);
+    EXPECT_EQ(log_prob_idx[0].first, 0u);
+
+    size_t allocations = count_allocations_of(
+        [&]() { get_pruned_log_probs(frame, 1.0, 3, false, prob_idx, log_prob_idx); });
+    EXPECT_EQ(allocations, 0u);
+}
+
+TEST(DecoderAllocationsTest, TestPathTriePoolRecyclesNodes)
+{
+    PathTriePool pool;
+    PathTrie* node = pool.acquire();
+    node->character = 3;
+    pool.release(node);
+
+    PathTrie* recycled = nullptr;
+    size_t allocations = count_allocations_of([&]() { recycled = pool.acquire(); });
+    EXPECT_EQ(allocations, 0u);
+    EXPECT_EQ(recycled, node);
+    EXPECT_EQ(recycled->character, -1);
+    delete recycled;
+}
+
+TEST(DecoderAllocationsTest, TestPathTriePoolCountsNodes)
+{
+    PathTriePool pool;
+    PathTrie* first = pool.acquire();
+    PathTrie* second = pool.acquire();
+    EXPECT_EQ(pool.num_live_nodes(), 2u);
+    EXPECT_EQ(pool.num_allocated_nodes(), 2u);
+
+    pool.release(first);
+    EXPECT_EQ(pool.num_live_nodes(), 1u);
+    EXPECT_EQ(pool.num_allocated_nodes(), 2u);
+
+    pool.trim();
+    EXPECT_EQ(pool.num_live_nodes(), 1u);
+    EXPECT_EQ(pool.num_allocated_nodes(), 1u);
+    pool.release(second);
+}
+
+TEST(DecoderAllocationsTest, TestSteadyStateFrameDoesNotAllocate)
+{
+    std::vector<std::string> vocab = { "_", "a", "b", "c", " " };
+    DecoderOptions options(vocab, 40, 1.0, 5, 1, 0, false, false, -5.0, '#');
+    DecoderState state(&options, nullptr, nullptr);
+
+    auto warmup_frames = make_blank_frames(10, vocab.size());
+    auto frames = make_blank_frames(100, vocab.size());
+
+    state.next(warmup_frames);
+    size_t allocations = count_allocations_of([&]() { state.next(frames); });
+    EXPECT_EQ(allocations, 0u);
+
+    auto results = state.decode();
+    ASSERT_FALSE(results.empty());
+    EXPECT_TRUE(results[0].second.tokens.empty());
+}
+
+TEST(DecoderAllocationsTest, TestSteadyStateFrameWithScorerDoesNotAllocate)
+{
+    std::vector<std::string> vocab = { "_", "a", "b", "c", " " };
+    std::vector<std::string> words = { "a", "ab", "abc", "ca" };
+    std::vector<float> log10_probs = { -1.0, -1.5, -2.0, -2.5 };
+    Scorer scorer(0.5, 1.0, new UnigramModel(words, log10_probs), vocab, "word", "");
+    DecoderOptions options(vocab, 40, 1.0, 5, 1, 0, false, false, -5.0, '#');
+    DecoderState state(&options, &scorer, nullptr);
+
+    // the space candidates of every frame query the language model
+    auto warmup_frames = make_blank_frames(10, vocab.size());
+    auto frames = make_blank_frames(100, vocab.size());
+
+    state.next(warmup_frames);
+    size_t allocations = count_allocations_of([&]() { state.next(frames); });
+    EXPECT_EQ(allocations, 0u);
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
@@ -2,6 +2,8 @@
 from __future__ import absolute_import, division, print_function
 
 import os
+import shutil
+import tempfile
 import unittest
 
 import torch
@@ -173,6 +175,164 @@ class TestDecoders(unittest.TestCase):
         )
         self.assertEqual(output_str, self.beam_search_result[2])
 
+    def test_beam_search_decoder_lm_lookahead(self):
+        lm_path = os.path.join(os.path.dirname(os.path.realpath(__file__)), "test.arpa")
+        probs_seq = torch.FloatTensor([self.probs_seq2])
+
+        decoder = ctcdecode.CTCBeamDecoder(
+            self.vocab_list,
+            beam_width=self.beam_size,
+            blank_id=self.vocab_list.index("_"),
+            model_path=lm_path,
+            lm_lookahead=True,
+        )
+        beam_result, beam_scores, timesteps, out_seq_len = decoder.decode(probs_seq)
+        output_str = self.convert_to_string(
+            beam_result[0][0], self.vocab_list, out_seq_len[0][0]
+        )
+        self.assertEqual(output_str, self.beam_search_result[2])
+
+    def test_beam_search_decoder_deadline(self):
+        probs_seq = torch.FloatTensor([self.probs_seq1])
+
+        decoder = ctcdecode.CTCBeamDecoder(
+            self.vocab_list,
+            beam_width=self.beam_size,
+            blank_id=self.vocab_list.index("_"),
+            deadline_ms=60000.0,
+        )
+        beam_result, beam_scores, timesteps, out_seq_len, degraded = decoder.decode(
+            probs_seq, return_degraded=True
+        )
+        output_str = self.convert_to_string(
+            beam_result[0][0], self.vocab_list, out_seq_len[0][0]
+        )
+        self.assertEqual(output_str, self.beam_search_result[0])
+        self.assertFalse(degraded[0])
+
+    def test_missing_lexicon_raises(self):
+        lm_path = os.path.join(os.path.dirname(os.path.realpath(__file__)), "test.arpa")
+        with self.assertRaises(RuntimeError):
+            ctcdecode.CTCBeamDecoder(
+                self.vocab_list,
+                beam_width=self.beam_size,
+                blank_id=self.vocab_list.index("_"),
+                model_path=lm_path,
+                lexicon_fst_path="/nonexistent/lexicon.fst",
+            )
+
+    def test_load_stats(self):
+        lm_path = os.path.join(os.path.dirname(os.path.realpath(__file__)), "test.arpa")
+        decoder = ctcdecode.CTCBeamDecoder(
+            self.vocab_list,
+            beam_width=self.beam_size,
+            blank_id=self.vocab_list.index("_"),
+            model_path=lm_path,
+        )
+        stats = decoder.load_stats()
+        self.assertGreater(stats["lm_seconds"], 0.0)
+        self.assertGreaterEqual(stats["total_seconds"], stats["lm_seconds"])
+
+    def test_shared_scorer(self):
+        lm_path = os.path.join(os.path.dirname(os.path.realpath(__file__)), "test.arpa")
+        probs_seq = torch.FloatTensor([self.probs_seq2])
+        with tempfile.TemporaryDirectory() as shared_dir:
+            shared_path = os.path.join(shared_dir, "scorer.fst")
+            # the first decoder publishes the scorer, the second one attaches to it
+            for _ in range(2):
+                decoder = ctcdecode.CTCBeamDecoder(
+                    self.vocab_list,
+                    beam_width=self.beam_size,
+                    blank_id=self.vocab_list.index("_"),
+                    model_path=lm_path,
+                    shared_scorer_path=shared_path,
+                )
+                beam_result, _, _, out_seq_len = decoder.decode(probs_seq)
+                output_str = self.convert_to_string(
+                    beam_result[0][0], self.vocab_list, out_seq_len[0][0]
+                )
+                self.assertEqual(output_str, self.beam_search_result[2])
+            self.assertTrue(os.path.exists(shared_path + ".meta"))
+
+    def test_shared_scorer_rebuilds_stale_resources(self):
+        lm_path = os.path.join(os.path.dirname(os.path.realpath(__file__)), "test.arpa")
+        probs_seq = torch.FloatTensor([self.probs_seq2])
+        with tempfile.TemporaryDirectory() as shared_dir:
+            shared_path = os.path.join(shared_dir, "scorer.fst")
+            ctcdecode.CTCBeamDecoder(
+                self.vocab_list,
+                blank_id=self.vocab_list.index("_"),
+                model_path=lm_path,
+                shared_scorer_path=shared_path,
+            )
+            with open(shared_path + ".meta") as meta_file:
+                meta = meta_file.read()
+            # pretend the resources were published for another language model
+            with open(shared_path + ".meta", "w") as meta_file:
+                meta_file.write(meta.replace(lm_path, lm_path + ".old"))
+
+            decoder = ctcdecode.CTCBeamDecoder(
+                self.vocab_list,
+                beam_width=self.beam_size,
+                blank_id=self.vocab_list.index("_"),
+                model_path=lm_path,
+                shared_scorer_path=shared_path,
+            )
+            beam_result, _, _, out_seq_len = decoder.decode(probs_seq)
+            output_str = self.convert_to_string(
+                beam_result[0][0], self.vocab_list, out_seq_len[0][0]
+            )
+            self.assertEqual(output_str, self.beam_search_result[2])
+            with open(shared_path + ".meta") as meta_file:
+                self.assertEqual(meta_file.read(), meta)
+
+    def test_shared_scorer_rebuilds_for_changed_lexicon(self):
+        test_dir = os.path.dirname(os.path.realpath(__file__))
+        lm_path = os.path.join(test_dir, "test.arpa")
+        fixture_path = os.path.join(test_dir, "..", "cpp", "fixtures", "expected_fst.fst")
+        with tempfile.TemporaryDirectory() as shared_dir:
+            shared_path = os.path.join(shared_dir, "scorer.fst")
+            lexicon_paths = [os.path.join(shared_dir, name) for name in ["a.fst", "b.fst"]]
+            for lexicon_path in lexicon_paths:
+                shutil.copyfile(fixture_path, lexicon_path)
+
+            def publish(lexicon_path):
+                ctcdecode.CTCBeamDecoder(
+                    self.vocab_list,
+                    blank_id=self.vocab_list.index("_"),
+                    model_path=lm_path,
+                    lexicon_fst_path=lexicon_path,
+                    shared_scorer_path=shared_path,
+                )
+                with open(shared_path + ".meta") as meta_file:
+                    return meta_file.read()
+
+            # another lexicon file, then the same file updated, are not attached to
+            meta = publish(lexicon_paths[0])
+            self.assertEqual(meta.splitlines()[2], lexicon_paths[0])
+            meta = publish(lexicon_paths[1])
+            self.assertEqual(meta.splitlines()[2], lexicon_paths[1])
+            mtime = os.stat(lexicon_paths[1]).st_mtime
+            os.utime(lexicon_paths[1], (mtime + 100, mtime + 100))
+            self.assertNotEqual(publish(lexicon_paths[1]), meta)
+
+    def test_warmup(self):
+        lm_path = os.path.join(os.path.dirname(os.path.realpath(__file__)), "test.arpa")
+        probs_seq = torch.FloatTensor([self.probs_seq2])
+        decoder = ctcdecode.CTCBeamDecoder(
+            self.vocab_list,
+            beam_width=self.beam_size,
+            blank_id=self.vocab_list.index("_"),
+            model_path=lm_path,
+            lm_load_method="huge_pages",
+        )
+        decoder.warmup()
+        beam_result, _, _, out_seq_len = decoder.decode(probs_seq)
+        output_str = self.convert_to_string(
+            beam_result[0][0], self.vocab_list, out_seq_len[0][0]
+        )
+        self.assertEqual(output_str, self.beam_search_result[2])
+
     def test_beam_search_decoder_batch(self):
         probs_seq = torch.FloatTensor([self.probs_seq1, self.probs_seq2])
         decoder = ctcdecode.CTCBeamDecoder(
@@ -327,6 +487,56 @@ class TestDecoders(unittest.TestCase):
         self.assertEqual(output_str1, self.beam_search_result[0])
         self.assertEqual(output_str2, self.beam_search_result[1])
 
+    def test_online_decoder_commit_prefix_no_lm(self):
+        decoder = ctcdecode.OnlineCTCBeamDecoder(
+            self.vocab_list,
+            beam_width=self.beam_size,
+            blank_id=self.vocab_list.index("_"),
+            log_probs_input=True,
+            num_processes=24,
+            commit_prefix=True,
+        )
+        state1 = ctcdecode.DecoderState(decoder)
+
+        probs_seq = torch.FloatTensor([self.probs_seq1]).log()
+
+        decoder.decode(probs_seq[:, :2], [state1], [False])
+        committed, committed_timesteps = decoder.take_committed(state1)
+        beam_results, beam_scores, timesteps, out_seq_len = decoder.decode(
+            probs_seq[:, 2:], [state1], [True]
+        )
+
+        del state1
+        self.assertEqual(len(committed), len(committed_timesteps))
+        output_str = self.convert_to_string(committed, self.vocab_list, len(committed))
+        output_str += self.convert_to_string(
+            beam_results[0][0], self.vocab_list, out_seq_len[0][0]
+        )
+        self.assertEqual(output_str, self.beam_search_result[0])
+
+    def test_online_decoder_best_partial_no_lm(self):
+        decoder = ctcdecode.OnlineCTCBeamDecoder(
+            self.vocab_list,
+            beam_width=self.beam_size,
+            blank_id=self.vocab_list.index("_"),
+            log_probs_input=True,
+            num_processes=24,
+        )
+        state1 = ctcdecode.DecoderState(decoder)
+        state2 = ctcdecode.DecoderState(decoder)
+
+        probs_seq = torch.FloatTensor([self.probs_seq1, self.probs_seq2]).log()
+
+        decoder.decode(probs_seq[:, :2], [state1, state2], [False, False])
+        decoder.decode(probs_seq[:, 2:], [state1, state2], [False, False])
+        partials = decoder.best_partial([state1, state2])
+
+        del state1, state2
+        self.assertEqual(len(partials), 2)
+        for (tokens, score, timesteps), expected in zip(partials, self.beam_search_result):
+            self.assertEqual(len(tokens), len(timesteps))
+            self.assertEqual(self.convert_to_string(tokens, self.vocab_list, len(tokens)), expected)
+
     def test_online_decoder_decoding_with_a_lot_calls_no_lm_check_size(self):
         decoder = ctcdecode.OnlineCTCBeamDecoder(
             self.vocab_list,
@@ -512,6 +722,32 @@ class TestDecoders(unittest.TestCase):
         decoder.delete_hotword_scorer(hotword_scorer)
         self.assertEqual(output_str, "b b")
 
+    def test_hotwords_loaded_with_the_decoder(self):
+        probs = [
+            [0.1, 0.2, 0.2, 0.1],
+            [0.4, 0.4, 0.1, 0.3],
+            [0.2, 0.3, 0.1, 0.4],
+            [0.3, 0.1, 0.6, 0.2],
+        ]
+        labels = ["_", "a", "b", " "]
+        probs = torch.Tensor(probs)
+        probs = torch.unsqueeze(probs.transpose(0, 1), dim=0)
+
+        decoder = ctcdecode.CTCBeamDecoder(
+            labels, blank_id=0, beam_width=100, hotwords=[list("b b")], hotword_weight=10
+        )
+        beam_result, _, _, out_seq_len = decoder.decode(probs)
+        output_str = self.convert_to_string(beam_result[0][0], labels, out_seq_len[0][0])
+        self.assertEqual(output_str, "b b")
+        self.assertIn("hotword_seconds", decoder.load_stats())
+
+        # hotwords given to decode() take over the ones loaded with the decoder
+        beam_result, _, _, out_seq_len = decoder.decode(
+            probs, hotwords=[["a"]], hotword_weight=10
+        )
+        output_str = self.convert_to_string(beam_result[0][0], labels, out_seq_len[0][0])
+        self.assertEqual(output_str, "a a")
+
 
 if __name__ == "__main__":
     unittest.main()
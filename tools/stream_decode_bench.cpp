@@ -0,0 +1,133 @@
+#include <chrono>
+#include <cxxopts.hpp>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+
+#include "ctc_beam_search_decoder.h"
+#include "decoder_options.h"
+#include "stream_worker_pool.h"
+
+// random frames whose probabilities sum to 1, with one dominant token per frame
+static std::vector<std::vector<double>>
+make_random_frames(size_t num_frames, size_t vocab_size, std::mt19937& generator)
+{
+    std::uniform_real_distribution<double> noise(0.0, 1.0);
+    std::uniform_int_distribution<size_t> token(0, vocab_size - 1);
+    std::vector<std::vector<double>> frames(num_frames, std::vector<double>(vocab_size));
+    for (auto& frame : frames) {
+        double sum = 0.0;
+        for (auto& prob : frame) {
+            prob = noise(generator);
+        }
+        frame[token(generator)] += 4.0;
+        for (auto prob : frame) {
+            sum += prob;
+        }
+        for (auto& prob : frame) {
+            prob /= sum;
+        }
+    }
+    return frames;
+}
+
+// decode the streams in chunks and return the frames decoded per second
+static double run_streams(const std::vector<std::vector<std::vector<double>>>& streams,
+                          DecoderOptions* options,
+                          size_t num_workers,
+                          size_t chunk_frames)
+{
+    std::vector<std::unique_ptr<DecoderState>> states;
+    std::vector<void*> state_ptrs;
+    for (size_t i = 0; i < streams.size(); ++i) {
+        states.push_back(std::make_unique<DecoderState>(options, nullptr, nullptr));
+        state_ptrs.push_back(states.back().get());
+    }
+
+    size_t num_frames = streams[0].size();
+    auto start_time = std::chrono::steady_clock::now();
+    for (size_t begin = 0; begin < num_frames; begin += chunk_frames) {
+        size_t end = std::min(begin + chunk_frames, num_frames);
+        std::vector<std::vector<std::vector<double>>> chunks;
+        for (const auto& frames : streams) {
+            chunks.emplace_back(frames.begin() + begin, frames.begin() + end);
+        }
+        std::vector<bool> is_eos(streams.size(), end == num_frames);
+        ctc_beam_search_decoder_batch_with_states(chunks, num_workers, state_ptrs, is_eos);
+    }
+    double seconds
+        = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    return streams.size() * num_frames / seconds;
+}
+
+int main(int argc, char* argv[])
+{
+    cxxopts::Options options("stream_decode_bench",
+                             "A program to measure the scaling of the streaming decoder with the "
+                             "number of workers and their placement");
+
+    options.add_options()(
+        "streams", "Number of streams", cxxopts::value<size_t>()->default_value("64"))(
+        "frames",
+        "Number of frames of each stream",
+        cxxopts::value<size_t>()->default_value("2000"))(
+        "chunk-frames",
+        "Number of frames of a chunk",
+        cxxopts::value<size_t>()->default_value("50"))(
+        "vocab-size", "Size of the vocabulary", cxxopts::value<size_t>()->default_value("64"))(
+        "beam-width", "Beam width", cxxopts::value<size_t>()->default_value("64"))(
+        "max-workers",
+        "Largest number of workers, doubled from 1",
+        cxxopts::value<size_t>()->default_value("16"))(
+        "pinning",
+        "Worker pinning: none, core or numa_node",
+        cxxopts::value<std::string>()->default_value("none"))("h,help", "Print usage");
+
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help")) {
+        std::cout << options.help() << std::endl;
+        exit(0);
+    }
+
+    std::map<std::string, WorkerPinning> pinnings = { { "none", WorkerPinning::NONE },
+                                                      { "core", WorkerPinning::CORE },
+                                                      { "numa_node", WorkerPinning::NUMA_NODE } };
+    auto pinning = pinnings.find(result["pinning"].as<std::string>());
+    if (pinning == pinnings.end()) {
+        std::cout << "Invalid pinning" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    size_t vocab_size = result["vocab-size"].as<size_t>();
+    std::vector<std::string> vocab = { "_", " " };
+    for (size_t i = vocab.size(); i < vocab_size; ++i) {
+        vocab.push_back(std::string(1, static_cast<char>('a' + i % 26)) + std::to_string(i / 26));
+    }
+    size_t beam_width = result["beam-width"].as<size_t>();
+    DecoderOptions decoder_options(
+        vocab, vocab_size, 1.0, beam_width, 1, 0, false, false, -5.0, '#');
+    decoder_options.worker_pinning = pinning->second;
+
+    std::mt19937 generator(0);
+    std::vector<std::vector<std::vector<double>>> streams;
+    for (size_t i = 0; i < result["streams"].as<size_t>(); ++i) {
+        streams.push_back(make_random_frames(result["frames"].as<size_t>(), vocab_size, generator));
+    }
+
+    std::cout << "NUMA nodes: " << StreamWorkerPool::get_numa_node_cpus().size() << std::endl;
+    std::cout << "workers\tframes/s\tspeedup" << std::endl;
+    double base_rate = 0.0;
+    for (size_t num_workers = 1; num_workers <= result["max-workers"].as<size_t>();
+         num_workers *= 2) {
+        double rate = run_streams(
+            streams, &decoder_options, num_workers, result["chunk-frames"].as<size_t>());
+        if (num_workers == 1) {
+            base_rate = rate;
+        }
+        std::cout << num_workers << "\t" << rate << "\t" << rate / base_rate << std::endl;
+    }
+
+    return 0;
+}